@@ -0,0 +1,66 @@
+#include "crop.h"
+
+#include <stdio.h>
+extern "C"
+{
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+}
+
+int crop_parse(CropRect *rect, const char *spec)
+{
+    if (sscanf(spec, "%d,%d,%d,%d", &rect->x, &rect->y, &rect->width, &rect->height) != 4 ||
+        rect->x < 0 || rect->y < 0 || rect->width <= 0 || rect->height <= 0) {
+        av_log(NULL, AV_LOG_ERROR, "Invalid crop '%s', expected x,y,width,height\n", spec);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+int crop_align(CropRect *rect, enum AVPixelFormat pix_fmt, int width, int height)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+    int x, y;
+
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL))) {
+        av_log(NULL, AV_LOG_ERROR, "Can't crop %s pictures in place\n", av_get_pix_fmt_name(pix_fmt));
+        return AVERROR(ENOSYS);
+    }
+
+    x = rect->x & ~((1 << desc->log2_chroma_w) - 1);
+    y = rect->y & ~((1 << desc->log2_chroma_h) - 1);
+    rect->width += rect->x - x;
+    rect->height += rect->y - y;
+    rect->x = x;
+    rect->y = y;
+
+    if (rect->x + rect->width > width || rect->y + rect->height > height) {
+        av_log(NULL, AV_LOG_ERROR, "Crop %d,%d,%d,%d is outside the %dx%d picture\n",
+               rect->x, rect->y, rect->width, rect->height, width, height);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+void crop_planes(const CropRect *rect, enum AVPixelFormat pix_fmt,
+                 uint8_t *const src[4], const int linesize[4], const uint8_t *dst[4])
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pix_fmt);
+    int max_step[4];
+    int i;
+
+    // same as the crop filter: the widest component step of a plane is the
+    // size of one pixel in it, for packed formats too
+    av_image_fill_max_pixsteps(max_step, NULL, desc);
+    for (i = 0; i < 4; i++) {
+        int hsub = (i == 1 || i == 2) ? desc->log2_chroma_w : 0;
+        int vsub = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+        if (!src[i]) {
+            dst[i] = NULL;
+            continue;
+        }
+        dst[i] = src[i] + (rect->y >> vsub) * linesize[i] + (rect->x >> hsub) * max_step[i];
+    }
+}
@@ -0,0 +1,42 @@
+/**
+ * @file region of interest cropping without copies
+ *
+ * A crop is applied by pointing every plane of the source at the top left
+ * corner of the rectangle and handing sws_scale() only its rows, so just the
+ * requested area is ever read and converted.
+ */
+#ifndef CROP_H
+#define CROP_H
+
+#include <stdint.h>
+extern "C"
+{
+#include <libavutil/pixfmt.h>
+}
+
+typedef struct CropRect {
+    int x, y;
+    int width, height;
+} CropRect;
+
+/**
+ * Parse "x,y,width,height". Returns AVERROR(EINVAL) on malformed input.
+ */
+int crop_parse(CropRect *rect, const char *spec);
+
+/**
+ * Check rect against a width x height picture and move its origin down to
+ * the chroma subsampling grid of pix_fmt, so every plane starts on a whole
+ * sample. The rectangle keeps covering the requested area.
+ */
+int crop_align(CropRect *rect, enum AVPixelFormat pix_fmt, int width, int height);
+
+/**
+ * Fill dst with the plane pointers of src offset to the origin of an aligned
+ * rect; linesizes are unchanged. Pass dst and src linesizes with rect->height
+ * rows to sws_scale() of a context created for rect->width x rect->height.
+ */
+void crop_planes(const CropRect *rect, enum AVPixelFormat pix_fmt,
+                 uint8_t *const src[4], const int linesize[4], const uint8_t *dst[4]);
+
+#endif /* CROP_H */
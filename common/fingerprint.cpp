@@ -0,0 +1,152 @@
+#include "fingerprint.h"
+
+#include <math.h>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+extern "C"
+{
+#include <libavutil/cpu.h>
+}
+
+#define HASH_SIZE 8 // 8x8 = 64 bits
+#define N FINGERPRINT_SIZE
+
+/*
+ * Only the first HASH_SIZE rows of the orthonormal DCT-II matrix are needed:
+ * the low frequencies are D * X * D^T with D the 8x32 top of the matrix.
+ */
+struct DctMatrix {
+    float m[HASH_SIZE][N];
+
+    DctMatrix()
+    {
+        for (int k = 0; k < HASH_SIZE; k++) {
+            float scale = k ? sqrtf(2.0f / N) : sqrtf(1.0f / N);
+            for (int i = 0; i < N; i++)
+                m[k][i] = scale * cosf((float)M_PI * (2 * i + 1) * k / (2 * N));
+        }
+    }
+};
+
+static const DctMatrix dct;
+
+static void load_luma(float x[N][N], const uint8_t *luma, int linesize)
+{
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            x[i][j] = luma[i * linesize + j];
+}
+
+static void low_frequencies_c(float out[HASH_SIZE][HASH_SIZE], const float x[N][N])
+{
+    float t[HASH_SIZE][N];
+
+    // t = D * X, then out = t * D^T
+    for (int k = 0; k < HASH_SIZE; k++) {
+        for (int j = 0; j < N; j++) {
+            float sum = 0;
+            for (int i = 0; i < N; i++)
+                sum += dct.m[k][i] * x[i][j];
+            t[k][j] = sum;
+        }
+    }
+    for (int k = 0; k < HASH_SIZE; k++) {
+        for (int l = 0; l < HASH_SIZE; l++) {
+            float sum = 0;
+            for (int j = 0; j < N; j++)
+                sum += t[k][j] * dct.m[l][j];
+            out[k][l] = sum;
+        }
+    }
+}
+
+#if HAVE_X86
+__attribute__((target("avx2")))
+static inline float hsum_avx2(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+/* Same as low_frequencies_c(), a row of 32 floats is 4 AVX registers. */
+__attribute__((target("avx2")))
+static void low_frequencies_avx2(float out[HASH_SIZE][HASH_SIZE], const float x[N][N])
+{
+    float t[HASH_SIZE][N];
+
+    for (int k = 0; k < HASH_SIZE; k++) {
+        __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+        for (int i = 0; i < N; i++) {
+            __m256 coef = _mm256_set1_ps(dct.m[k][i]);
+            for (int r = 0; r < 4; r++)
+                acc[r] = _mm256_add_ps(acc[r], _mm256_mul_ps(coef, _mm256_loadu_ps(&x[i][r * 8])));
+        }
+        for (int r = 0; r < 4; r++)
+            _mm256_storeu_ps(&t[k][r * 8], acc[r]);
+    }
+    for (int k = 0; k < HASH_SIZE; k++) {
+        for (int l = 0; l < HASH_SIZE; l++) {
+            __m256 acc = _mm256_setzero_ps();
+            for (int r = 0; r < 4; r++)
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(&t[k][r * 8]),
+                                                       _mm256_loadu_ps(&dct.m[l][r * 8])));
+            out[k][l] = hsum_avx2(acc);
+        }
+    }
+}
+#endif
+
+uint64_t fingerprint_phash(const uint8_t *luma, int linesize)
+{
+    float x[N][N];
+    float coefs[HASH_SIZE][HASH_SIZE];
+    float sorted[HASH_SIZE * HASH_SIZE - 1];
+    uint64_t hash = 0;
+    float median;
+
+    load_luma(x, luma, linesize);
+#if HAVE_X86
+    if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+        low_frequencies_avx2(coefs, x);
+    else
+#endif
+        low_frequencies_c(coefs, x);
+
+    // the DC term is the mean brightness and dwarfs the others, leave it
+    // out of the median so brightness doesn't bias every bit
+    std::copy(&coefs[0][0] + 1, &coefs[0][0] + HASH_SIZE * HASH_SIZE, sorted);
+    std::nth_element(sorted, sorted + (HASH_SIZE * HASH_SIZE - 1) / 2, sorted + HASH_SIZE * HASH_SIZE - 1);
+    median = sorted[(HASH_SIZE * HASH_SIZE - 1) / 2];
+
+    for (int k = 0; k < HASH_SIZE; k++)
+        for (int l = 0; l < HASH_SIZE; l++)
+            if (coefs[k][l] > median)
+                hash |= 1ULL << (k * HASH_SIZE + l);
+    return hash;
+}
+
+uint64_t fingerprint_ahash(const uint8_t *luma, int linesize)
+{
+    const int block = N / HASH_SIZE;
+    unsigned sums[HASH_SIZE * HASH_SIZE] = { 0 };
+    unsigned total = 0;
+    uint64_t hash = 0;
+
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            sums[(i / block) * HASH_SIZE + j / block] += luma[i * linesize + j];
+    for (int b = 0; b < HASH_SIZE * HASH_SIZE; b++)
+        total += sums[b];
+    // compare sums against the mean sum, no division needed
+    for (int b = 0; b < HASH_SIZE * HASH_SIZE; b++)
+        if (sums[b] * HASH_SIZE * HASH_SIZE > total)
+            hash |= 1ULL << b;
+    return hash;
+}
@@ -0,0 +1,33 @@
+/**
+ * @file perceptual frame hashes
+ *
+ * Both hashes work on a FINGERPRINT_SIZE x FINGERPRINT_SIZE 8 bit luma
+ * thumbnail of the frame (sws_scale() to AV_PIX_FMT_GRAY8 with SWS_AREA),
+ * and similar pictures get hashes a small Hamming distance apart:
+ *
+ * - pHash: the 8x8 lowest frequencies of the 2D DCT of the thumbnail, one
+ *   bit per coefficient above the median of the 63 AC ones. Robust to
+ *   rescaling, recompression and small brightness/contrast changes.
+ * - aHash: the thumbnail averaged down to 8x8, one bit per block brighter
+ *   than the mean. Cheaper and coarser.
+ */
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdint.h>
+
+#define FINGERPRINT_SIZE 32
+
+/**
+ * @param luma      FINGERPRINT_SIZE rows of FINGERPRINT_SIZE samples
+ * @param linesize  bytes between rows
+ */
+uint64_t fingerprint_phash(const uint8_t *luma, int linesize);
+uint64_t fingerprint_ahash(const uint8_t *luma, int linesize);
+
+static inline int fingerprint_distance(uint64_t a, uint64_t b)
+{
+    return __builtin_popcountll(a ^ b);
+}
+
+#endif /* FINGERPRINT_H */
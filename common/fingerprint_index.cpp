@@ -0,0 +1,73 @@
+#include "fingerprint_index.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+extern "C"
+{
+#include <libavutil/error.h>
+#include <libavutil/file.h>
+#include <libavutil/log.h>
+}
+
+int fingerprint_index_write(const char *filename, FingerprintEntry *entries, size_t nb_entries)
+{
+    FingerprintIndexHeader header;
+    FILE *f;
+    int ret = 0;
+
+    // workers finish frames out of order
+    std::sort(entries, entries + nb_entries,
+              [](const FingerprintEntry &a, const FingerprintEntry &b) { return a.pts_ms < b.pts_ms; });
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FINGERPRINT_INDEX_MAGIC, sizeof(header.magic));
+    header.byte_order = FINGERPRINT_INDEX_BYTE_ORDER;
+    header.nb_entries = nb_entries;
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s\n", filename);
+        return AVERROR(errno);
+    }
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        (nb_entries && fwrite(entries, sizeof(*entries), nb_entries, f) != nb_entries))
+        ret = AVERROR(EIO);
+    if (fclose(f) && ret >= 0)
+        ret = AVERROR(EIO);
+    return ret;
+}
+
+int fingerprint_index_load(FingerprintIndex *index, const char *filename)
+{
+    const FingerprintIndexHeader *header;
+    int ret;
+
+    memset(index, 0, sizeof(*index));
+    ret = av_file_map(filename, &index->buffer, &index->size, 0, NULL);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s\n", filename);
+        return ret;
+    }
+
+    header = (const FingerprintIndexHeader *)index->buffer;
+    if (index->size < sizeof(*header) ||
+        memcmp(header->magic, FINGERPRINT_INDEX_MAGIC, sizeof(header->magic)) ||
+        header->byte_order != FINGERPRINT_INDEX_BYTE_ORDER ||
+        index->size != sizeof(*header) + header->nb_entries * sizeof(FingerprintEntry)) {
+        av_log(NULL, AV_LOG_ERROR, "%s is not a valid fingerprint index\n", filename);
+        fingerprint_index_free(index);
+        return AVERROR_INVALIDDATA;
+    }
+    index->header = header;
+    index->entries = (const FingerprintEntry *)(header + 1);
+    return 0;
+}
+
+void fingerprint_index_free(FingerprintIndex *index)
+{
+    if (index->buffer)
+        av_file_unmap(index->buffer, index->size);
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,56 @@
+/**
+ * @file frame fingerprint index
+ *
+ * Perceptual hashes (see fingerprint.h) of the frames of one media file,
+ * written by video2image and searched by fingerprint_query, so a library can
+ * be compared without decoding it again. Laid out to be mapped as is:
+ *
+ *   FingerprintIndexHeader
+ *   FingerprintEntry  [header.nb_entries], in presentation order
+ *
+ * All fields are in the byte order of the indexing host, which byte_order in
+ * the header records; an index from a host of the other order is rejected.
+ */
+#ifndef FINGERPRINT_INDEX_H
+#define FINGERPRINT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FINGERPRINT_INDEX_MAGIC "FPIDX002"
+#define FINGERPRINT_INDEX_EXTENSION ".fpidx"
+#define FINGERPRINT_INDEX_BYTE_ORDER 0x01020304
+
+typedef struct FingerprintIndexHeader {
+    char magic[8];
+    uint32_t byte_order; ///< FINGERPRINT_INDEX_BYTE_ORDER as written by the indexing host
+    uint32_t reserved;
+    uint64_t nb_entries;
+} FingerprintIndexHeader;
+
+typedef struct FingerprintEntry {
+    int64_t pts_ms; ///< presentation time in milliseconds from the start of the file
+    uint64_t phash;
+    uint64_t ahash;
+} FingerprintEntry;
+
+typedef struct FingerprintIndex {
+    uint8_t *buffer; ///< mapped index file
+    size_t size;
+    const FingerprintIndexHeader *header;
+    const FingerprintEntry *entries;
+} FingerprintIndex;
+
+/**
+ * Write entries, sorting them by time first.
+ */
+int fingerprint_index_write(const char *filename, FingerprintEntry *entries, size_t nb_entries);
+
+/**
+ * Map and validate an index file.
+ */
+int fingerprint_index_load(FingerprintIndex *index, const char *filename);
+
+void fingerprint_index_free(FingerprintIndex *index);
+
+#endif /* FINGERPRINT_INDEX_H */
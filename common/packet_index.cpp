@@ -0,0 +1,189 @@
+#include "packet_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+extern "C"
+{
+#include <libavutil/avstring.h>
+#include <libavutil/file.h>
+#include <libavutil/mem.h>
+}
+
+char *packet_index_filename(const char *media_filename)
+{
+    return av_asprintf("%s%s", media_filename, PACKET_INDEX_EXTENSION);
+}
+
+int packet_index_build(AVFormatContext *fmt_ctx, const char *index_filename)
+{
+    std::vector<std::vector<PacketIndexEntry>> entries(fmt_ctx->nb_streams);
+    std::vector<PacketIndexStream> streams(fmt_ctx->nb_streams);
+    PacketIndexHeader header;
+    AVPacket *pkt;
+    FILE *f;
+    uint64_t first_entry = 0;
+    unsigned int i;
+    int ret;
+
+    pkt = av_packet_alloc();
+    if (!pkt)
+        return AVERROR(ENOMEM);
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index < (int)fmt_ctx->nb_streams) {
+            PacketIndexEntry entry;
+            entry.pts = pkt->pts;
+            entry.dts = pkt->dts;
+            entry.pos = pkt->pos;
+            entry.size = pkt->size;
+            entry.stream_index = pkt->stream_index;
+            entry.flags = pkt->flags;
+            entries[pkt->stream_index].push_back(entry);
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    if (ret != AVERROR_EOF)
+        return ret;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACKET_INDEX_MAGIC, sizeof(header.magic));
+    header.nb_streams = fmt_ctx->nb_streams;
+    header.byte_order = PACKET_INDEX_BYTE_ORDER;
+    header.media_size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        memset(&streams[i], 0, sizeof(streams[i]));
+        streams[i].codec_type = st->codecpar->codec_type;
+        streams[i].time_base_num = st->time_base.num;
+        streams[i].time_base_den = st->time_base.den;
+        streams[i].first_entry = first_entry;
+        streams[i].nb_entries = entries[i].size();
+        first_entry += entries[i].size();
+    }
+    header.nb_entries = first_entry;
+
+    f = fopen(index_filename, "wb");
+    if (!f) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s\n", index_filename);
+        return AVERROR(errno);
+    }
+    ret = 0;
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        (header.nb_streams && fwrite(streams.data(), sizeof(PacketIndexStream), streams.size(), f) != streams.size()))
+        ret = AVERROR(EIO);
+    for (i = 0; ret >= 0 && i < fmt_ctx->nb_streams; i++) {
+        if (!entries[i].empty() &&
+            fwrite(entries[i].data(), sizeof(PacketIndexEntry), entries[i].size(), f) != entries[i].size())
+            ret = AVERROR(EIO);
+    }
+    if (fclose(f) && ret >= 0)
+        ret = AVERROR(EIO);
+    return ret;
+}
+
+int packet_index_load(PacketIndex *index, const char *index_filename)
+{
+    const PacketIndexHeader *header;
+    uint64_t expected_size;
+    uint32_t i;
+    int ret;
+
+    memset(index, 0, sizeof(*index));
+    ret = av_file_map(index_filename, &index->buffer, &index->size, 0, NULL);
+    if (ret < 0)
+        return ret;
+
+    header = (const PacketIndexHeader *)index->buffer;
+    if (index->size < sizeof(*header) || memcmp(header->magic, PACKET_INDEX_MAGIC, sizeof(header->magic)) ||
+        header->byte_order != PACKET_INDEX_BYTE_ORDER)
+        goto invalid;
+    expected_size = sizeof(*header) +
+                    (uint64_t)header->nb_streams * sizeof(PacketIndexStream) +
+                    header->nb_entries * sizeof(PacketIndexEntry);
+    if (expected_size != index->size)
+        goto invalid;
+
+    index->header = header;
+    index->streams = (const PacketIndexStream *)(header + 1);
+    index->entries = (const PacketIndexEntry *)(index->streams + header->nb_streams);
+    for (i = 0; i < header->nb_streams; i++) {
+        if (index->streams[i].first_entry + index->streams[i].nb_entries > header->nb_entries)
+            goto invalid;
+    }
+    return 0;
+
+invalid:
+    av_log(NULL, AV_LOG_ERROR, "%s is not a valid packet index\n", index_filename);
+    packet_index_free(index);
+    return AVERROR_INVALIDDATA;
+}
+
+void packet_index_free(PacketIndex *index)
+{
+    if (index->buffer)
+        av_file_unmap(index->buffer, index->size);
+    memset(index, 0, sizeof(*index));
+}
+
+static int64_t entry_timestamp(const PacketIndexEntry &entry)
+{
+    return entry.dts != AV_NOPTS_VALUE ? entry.dts : entry.pts;
+}
+
+const PacketIndexEntry *packet_index_find_keyframe(const PacketIndex *index,
+                                                   int stream_index, int64_t timestamp)
+{
+    const PacketIndexStream *st;
+    const PacketIndexEntry *begin, *end, *it;
+
+    if (!index->header || stream_index < 0 || (uint32_t)stream_index >= index->header->nb_streams)
+        return NULL;
+    st = &index->streams[stream_index];
+    begin = index->entries + st->first_entry;
+    end = begin + st->nb_entries;
+
+    // packets are stored in decoding order, so dts is monotonic within a
+    // stream; find the first one past timestamp, then walk back to a keyframe
+    it = std::upper_bound(begin, end, timestamp,
+                          [](int64_t ts, const PacketIndexEntry &entry) { return ts < entry_timestamp(entry); });
+    while (it != begin) {
+        --it;
+        if ((it->flags & AV_PKT_FLAG_KEY) &&
+            (it->pts == AV_NOPTS_VALUE || it->pts <= timestamp))
+            return it;
+    }
+    return NULL;
+}
+
+int packet_index_seek(AVFormatContext *fmt_ctx, const PacketIndex *index,
+                      int stream_index, int64_t timestamp)
+{
+    const PacketIndexEntry *entry;
+    int ret = AVERROR(ENOSYS);
+
+    // the media was rewritten since it was indexed, positions mean nothing
+    if (index->header && fmt_ctx->pb && index->header->media_size >= 0 &&
+        avio_size(fmt_ctx->pb) != index->header->media_size) {
+        av_log(NULL, AV_LOG_WARNING, "Packet index is stale, ignoring it\n");
+        return av_seek_frame(fmt_ctx, stream_index, timestamp, AVSEEK_FLAG_BACKWARD);
+    }
+
+    entry = packet_index_find_keyframe(index, stream_index, timestamp);
+    if (!entry) {
+        // before the first keyframe, start from the top of the stream
+        if (!index->header || stream_index < 0 || (uint32_t)stream_index >= index->header->nb_streams ||
+            !index->streams[stream_index].nb_entries)
+            return AVERROR(EINVAL);
+        entry = index->entries + index->streams[stream_index].first_entry;
+    }
+
+    if (entry->pos >= 0 && !(fmt_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        ret = av_seek_frame(fmt_ctx, -1, entry->pos, AVSEEK_FLAG_BYTE);
+    if (ret < 0)
+        ret = av_seek_frame(fmt_ctx, stream_index, entry_timestamp(*entry), AVSEEK_FLAG_BACKWARD);
+    return ret;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file sidecar packet index
+ *
+ * One pass of av_read_frame() over a media file records, for every packet,
+ * its timestamps, byte position, size and keyframe flag into a flat binary
+ * file next to the media ("<media>.pktidx"). The file is laid out so it can
+ * be mapped and used as is:
+ *
+ *   PacketIndexHeader
+ *   PacketIndexStream  [header.nb_streams]
+ *   PacketIndexEntry   [header.nb_entries], grouped by stream, in file order
+ *
+ * All fields are in the byte order of the indexing host, which byte_order in
+ * the header records; an index from a host of the other order is rejected.
+ */
+#ifndef PACKET_INDEX_H
+#define PACKET_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#define PACKET_INDEX_MAGIC "PKTIDX01"
+#define PACKET_INDEX_EXTENSION ".pktidx"
+#define PACKET_INDEX_BYTE_ORDER 0x01020304
+
+typedef struct PacketIndexHeader {
+    char magic[8];
+    uint32_t nb_streams;
+    uint32_t byte_order; ///< PACKET_INDEX_BYTE_ORDER as written by the indexing host
+    uint64_t nb_entries;
+    int64_t media_size; ///< size of the indexed file, to detect stale indexes
+} PacketIndexHeader;
+
+typedef struct PacketIndexStream {
+    int32_t codec_type; ///< enum AVMediaType
+    int32_t time_base_num;
+    int32_t time_base_den;
+    uint32_t reserved;
+    uint64_t first_entry;
+    uint64_t nb_entries;
+} PacketIndexStream;
+
+typedef struct PacketIndexEntry {
+    int64_t pts; ///< in the stream time base, AV_NOPTS_VALUE if unknown
+    int64_t dts;
+    int64_t pos; ///< byte offset of the packet in the media file, -1 if unknown
+    int32_t size;
+    uint16_t stream_index;
+    uint16_t flags; ///< AV_PKT_FLAG_*
+} PacketIndexEntry;
+
+typedef struct PacketIndex {
+    uint8_t *buffer; ///< mapped index file
+    size_t size;
+    const PacketIndexHeader *header;
+    const PacketIndexStream *streams;
+    const PacketIndexEntry *entries;
+} PacketIndex;
+
+/**
+ * Return the sidecar file name for a media file, to be freed with av_free().
+ */
+char *packet_index_filename(const char *media_filename);
+
+/**
+ * Read every packet of an opened input and write the index to
+ * index_filename. The input is left at EOF.
+ */
+int packet_index_build(AVFormatContext *fmt_ctx, const char *index_filename);
+
+/**
+ * Map and validate an index file. Returns AVERROR(ENOENT) when there is none,
+ * so callers can fall back to regular seeking.
+ */
+int packet_index_load(PacketIndex *index, const char *index_filename);
+
+void packet_index_free(PacketIndex *index);
+
+/**
+ * Last keyframe of a stream with a presentation time not after timestamp
+ * (in the stream time base), or NULL.
+ */
+const PacketIndexEntry *packet_index_find_keyframe(const PacketIndex *index,
+                                                   int stream_index, int64_t timestamp);
+
+/**
+ * Position fmt_ctx on the keyframe preceding timestamp (in the time base of
+ * stream_index) by seeking straight to its byte offset. Demuxers that can't
+ * seek by byte are seeked to the keyframe timestamp instead. An index whose
+ * media_size doesn't match the input is stale and ignored: fmt_ctx is then
+ * seeked to timestamp with av_seek_frame().
+ */
+int packet_index_seek(AVFormatContext *fmt_ctx, const PacketIndex *index,
+                      int stream_index, int64_t timestamp);
+
+#endif /* PACKET_INDEX_H */
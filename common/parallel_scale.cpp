@@ -0,0 +1,167 @@
+#include "parallel_scale.h"
+
+#include <thread>
+#include <vector>
+extern "C"
+{
+#include <libavutil/buffer.h>
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#define MIN_BAND_ROWS 16
+
+struct ParallelScaler {
+    int src_w, src_h, dst_w, dst_h;
+    enum AVPixelFormat src_fmt, dst_fmt;
+    std::vector<struct SwsContext *> contexts; ///< one per band
+    std::vector<int> bands; ///< first destination row of every band, then dst_h
+};
+
+ParallelScaler *parallel_scaler_alloc(int src_w, int src_h, enum AVPixelFormat src_fmt,
+                                      int dst_w, int dst_h, enum AVPixelFormat dst_fmt,
+                                      int flags, int threads)
+{
+    ParallelScaler *scaler = new ParallelScaler;
+    struct SwsContext *first;
+    int align, band, count;
+
+    scaler->src_w = src_w;
+    scaler->src_h = src_h;
+    scaler->src_fmt = src_fmt;
+    scaler->dst_w = dst_w;
+    scaler->dst_h = dst_h;
+    scaler->dst_fmt = dst_fmt;
+
+    first = sws_getContext(src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt, flags, NULL, NULL, NULL);
+    if (!first) {
+        av_log(NULL, AV_LOG_ERROR, "Can't scale %s %dx%d to %s %dx%d\n",
+               av_get_pix_fmt_name(src_fmt), src_w, src_h, av_get_pix_fmt_name(dst_fmt), dst_w, dst_h);
+        delete scaler;
+        return NULL;
+    }
+    scaler->contexts.push_back(first);
+
+    if (threads <= 0)
+        threads = av_cpu_count();
+    align = sws_receive_slice_alignment(first);
+    // every band but the whole frame must start and end on the alignment
+    count = dst_h % align ? 1 : av_clip(threads, 1, FFMAX(dst_h / FFMAX(MIN_BAND_ROWS, align), 1));
+    band = FFALIGN((dst_h + count - 1) / count, align);
+    for (int y = 0; y < dst_h; y += band)
+        scaler->bands.push_back(y);
+    scaler->bands.push_back(dst_h);
+
+    while (scaler->contexts.size() < scaler->bands.size() - 1) {
+        struct SwsContext *ctx = sws_getContext(src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt, flags, NULL, NULL, NULL);
+        if (!ctx) {
+            parallel_scaler_free(&scaler);
+            return NULL;
+        }
+        scaler->contexts.push_back(ctx);
+    }
+    return scaler;
+}
+
+void parallel_scaler_free(ParallelScaler **scaler)
+{
+    if (!*scaler)
+        return;
+    for (struct SwsContext *ctx : (*scaler)->contexts)
+        sws_freeContext(ctx);
+    delete *scaler;
+    *scaler = NULL;
+}
+
+int parallel_scaler_threads(const ParallelScaler *scaler)
+{
+    return (int)scaler->contexts.size();
+}
+
+static int scale_band(struct SwsContext *ctx, AVFrame *dst, const AVFrame *src, int y0, int y1)
+{
+    int ret = sws_frame_start(ctx, dst, src);
+    if (ret >= 0)
+        ret = sws_send_slice(ctx, 0, src->height);
+    if (ret >= 0)
+        ret = sws_receive_slice(ctx, y0, y1 - y0);
+    sws_frame_end(ctx);
+    return ret;
+}
+
+int parallel_scale_frame(ParallelScaler *scaler, AVFrame *dst, const AVFrame *src)
+{
+    std::vector<std::thread> workers;
+    std::vector<int> results(scaler->contexts.size());
+    int ret;
+
+    if (src->width != scaler->src_w || src->height != scaler->src_h || src->format != scaler->src_fmt)
+        return AVERROR(EINVAL);
+    if (!dst->buf[0]) {
+        dst->width = scaler->dst_w;
+        dst->height = scaler->dst_h;
+        dst->format = scaler->dst_fmt;
+        if ((ret = av_frame_get_buffer(dst, 0)) < 0)
+            return ret;
+    }
+
+    for (size_t i = 1; i < scaler->contexts.size(); i++)
+        workers.emplace_back([&, i] {
+            results[i] = scale_band(scaler->contexts[i], dst, src, scaler->bands[i], scaler->bands[i + 1]);
+        });
+    results[0] = scale_band(scaler->contexts[0], dst, src, scaler->bands[0], scaler->bands[1]);
+    for (auto &worker : workers)
+        worker.join();
+
+    for (int result : results)
+        if (result < 0)
+            return result;
+    return 0;
+}
+
+static void borrowed_free(void *opaque, uint8_t *data)
+{
+}
+
+/*
+ * Point frame at the caller's planes. The buffer reference owns nothing, it
+ * only makes sws_frame_start() reference the planes instead of copying them.
+ */
+static int borrow_image(AVFrame *frame, const uint8_t *const data[4], const int linesize[4],
+                        enum AVPixelFormat pix_fmt, int width, int height)
+{
+    frame->format = pix_fmt;
+    frame->width = width;
+    frame->height = height;
+    for (int i = 0; i < 4; i++) {
+        frame->data[i] = (uint8_t *)data[i];
+        frame->linesize[i] = linesize[i];
+    }
+    frame->buf[0] = av_buffer_create((uint8_t *)data[0], 1, borrowed_free, NULL, 0);
+    return frame->buf[0] ? 0 : AVERROR(ENOMEM);
+}
+
+int parallel_scale(ParallelScaler *scaler, const uint8_t *const src[4], const int src_linesize[4],
+                   uint8_t *const dst[4], const int dst_linesize[4])
+{
+    AVFrame *src_frame = av_frame_alloc(), *dst_frame = av_frame_alloc();
+    int ret;
+
+    if (!src_frame || !dst_frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = borrow_image(src_frame, src, src_linesize, scaler->src_fmt, scaler->src_w, scaler->src_h)) < 0 ||
+        (ret = borrow_image(dst_frame, dst, dst_linesize, scaler->dst_fmt, scaler->dst_w, scaler->dst_h)) < 0)
+        goto end;
+    ret = parallel_scale_frame(scaler, dst_frame, src_frame);
+
+end:
+    av_frame_free(&src_frame);
+    av_frame_free(&dst_frame);
+    return ret;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file sws_scale() across threads
+ *
+ * The destination is split into horizontal bands, one per thread, and every
+ * band has its own SwsContext for the full conversion. A band is produced
+ * with sws_receive_slice(), which only reads the source rows its output
+ * lines need, so the threads share nothing but the (read only) source.
+ *
+ * Bands start on multiples of sws_receive_slice_alignment(); when the
+ * destination height doesn't allow that the frame is scaled in one piece.
+ */
+#ifndef PARALLEL_SCALE_H
+#define PARALLEL_SCALE_H
+
+#include <stdint.h>
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+typedef struct ParallelScaler ParallelScaler;
+
+/**
+ * Same parameters as sws_getContext(), plus the number of bands; threads 0
+ * is one per CPU. Returns NULL if the conversion is not supported.
+ */
+ParallelScaler *parallel_scaler_alloc(int src_w, int src_h, enum AVPixelFormat src_fmt,
+                                      int dst_w, int dst_h, enum AVPixelFormat dst_fmt,
+                                      int flags, int threads);
+
+void parallel_scaler_free(ParallelScaler **scaler);
+
+/** Number of bands actually used. */
+int parallel_scaler_threads(const ParallelScaler *scaler);
+
+/**
+ * Scale a whole picture, like sws_scale() with the full source height.
+ * The buffers stay the caller's; they don't need to be refcounted.
+ */
+int parallel_scale(ParallelScaler *scaler, const uint8_t *const src[4], const int src_linesize[4],
+                   uint8_t *const dst[4], const int dst_linesize[4]);
+
+/** Scale src into dst, allocating dst if it has no buffers, like sws_scale_frame(). */
+int parallel_scale_frame(ParallelScaler *scaler, AVFrame *dst, const AVFrame *src);
+
+#endif /* PARALLEL_SCALE_H */
@@ -0,0 +1,476 @@
+#include "test_pattern.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+extern "C"
+{
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+}
+
+#define SINE_SIZE 1024
+#define MIN_BAND_ROWS 16
+
+enum Layout {
+    LAYOUT_PLANAR, ///< one plane per component
+    LAYOUT_SEMIPLANAR, ///< luma plane, then interleaved Cb Cr
+    LAYOUT_RGB24, ///< packed R G B
+};
+
+struct FormatInfo {
+    enum AVPixelFormat pix_fmt;
+    Layout layout;
+    int components; ///< 1 for gray
+    int depth; ///< bits per sample, stored in 8 or 16 bit words
+    bool msb; ///< samples are in the high bits of their word (P010)
+    int shift_w, shift_h; ///< chroma subsampling
+};
+
+static const FormatInfo formats[] = {
+    { AV_PIX_FMT_GRAY8, LAYOUT_PLANAR, 1, 8, false, 0, 0 },
+    { AV_PIX_FMT_YUV420P, LAYOUT_PLANAR, 3, 8, false, 1, 1 },
+    { AV_PIX_FMT_YUV422P, LAYOUT_PLANAR, 3, 8, false, 1, 0 },
+    { AV_PIX_FMT_YUV444P, LAYOUT_PLANAR, 3, 8, false, 0, 0 },
+    { AV_PIX_FMT_YUV420P10LE, LAYOUT_PLANAR, 3, 10, false, 1, 1 },
+    { AV_PIX_FMT_YUV422P10LE, LAYOUT_PLANAR, 3, 10, false, 1, 0 },
+    { AV_PIX_FMT_YUV444P10LE, LAYOUT_PLANAR, 3, 10, false, 0, 0 },
+    { AV_PIX_FMT_NV12, LAYOUT_SEMIPLANAR, 3, 8, false, 1, 1 },
+    { AV_PIX_FMT_P010LE, LAYOUT_SEMIPLANAR, 3, 10, true, 1, 1 },
+    { AV_PIX_FMT_RGB24, LAYOUT_RGB24, 3, 8, false, 0, 0 },
+};
+
+/* Y, Cb, Cr of 75% colour bars, BT.601 limited range. */
+static const uint8_t bar_colors[8][3] = {
+    { 180, 128, 128 }, // white
+    { 162, 44, 142 }, // yellow
+    { 131, 156, 44 }, // cyan
+    { 112, 72, 58 }, // green
+    { 84, 184, 198 }, // magenta
+    { 65, 100, 212 }, // red
+    { 35, 212, 114 }, // blue
+    { 16, 128, 128 }, // black
+};
+
+/* 5x7 glyphs, one byte per row with the leftmost pixel in bit 4. */
+static const char font_chars[] = "0123456789AEFMR";
+static const uint8_t font[][7] = {
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+    { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+};
+
+struct SineTable {
+    int32_t v[SINE_SIZE];
+
+    SineTable()
+    {
+        for (int i = 0; i < SINE_SIZE; i++)
+            v[i] = lrintf(128 + 127 * sinf(2 * (float)M_PI * i / SINE_SIZE)) << 8;
+    }
+};
+
+static const SineTable sine;
+
+#if HAVE_X86
+__attribute__((target("avx2")))
+static void gradient_row_avx2(uint16_t *dst, int n, int base, int step)
+{
+    __m256i value = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+                                                        _mm256_set1_epi16(step)),
+                                     _mm256_set1_epi16((int16_t)base));
+    __m256i increment = _mm256_set1_epi16(16 * step);
+
+    for (int x = 0; x < n; x += 16) {
+        // shifting the high byte out wraps at 8 bits
+        _mm256_storeu_si256((__m256i *)(dst + x), _mm256_slli_epi16(value, 8));
+        value = _mm256_add_epi16(value, increment);
+    }
+}
+
+/* Eight noise_hash() at once. */
+__attribute__((target("avx2")))
+static inline __m256i noise_hash_avx2(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68b));
+    return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+}
+
+/* packus works within 128 bit lanes, put the two halves back in order */
+__attribute__((target("avx2")))
+static inline __m256i pack_u32_avx2(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+}
+
+__attribute__((target("avx2")))
+static void noise_row_avx2(uint16_t *dst, int n, uint32_t seed)
+{
+    __m256i lo = _mm256_add_epi32(_mm256_set1_epi32((int)seed), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i hi = _mm256_add_epi32(lo, _mm256_set1_epi32(8));
+    __m256i increment = _mm256_set1_epi32(16);
+
+    for (int x = 0; x < n; x += 16) {
+        __m256i a = _mm256_srli_epi32(noise_hash_avx2(lo), 16);
+        __m256i b = _mm256_srli_epi32(noise_hash_avx2(hi), 16);
+        _mm256_storeu_si256((__m256i *)(dst + x), pack_u32_avx2(a, b));
+        lo = _mm256_add_epi32(lo, increment);
+        hi = _mm256_add_epi32(hi, increment);
+    }
+}
+
+__attribute__((target("avx2")))
+static void zoneplate_row_avx2(uint16_t *dst, int n, int center, int dy2, float scale, float phase)
+{
+    __m256i dx = _mm256_sub_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(center));
+    __m256i mask = _mm256_set1_epi32(SINE_SIZE - 1);
+    __m256 vscale = _mm256_set1_ps(scale), vphase = _mm256_set1_ps(phase);
+
+    for (int x = 0; x < n; x += 16) {
+        __m256i v[2];
+        for (int h = 0; h < 2; h++) {
+            __m256i d = _mm256_add_epi32(dx, _mm256_set1_epi32(x + 8 * h));
+            __m256i r2 = _mm256_add_epi32(_mm256_mullo_epi32(d, d), _mm256_set1_epi32(dy2));
+            __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(r2), vscale), vphase);
+            __m256i index = _mm256_and_si256(_mm256_cvttps_epi32(p), mask);
+            v[h] = _mm256_i32gather_epi32((const int *)sine.v, index, 4);
+        }
+        _mm256_storeu_si256((__m256i *)(dst + x), pack_u32_avx2(v[0], v[1]));
+    }
+}
+
+__attribute__((target("avx2")))
+static void pack8_avx2(uint8_t *dst, const uint16_t *src, int n)
+{
+    for (int x = 0; x < n; x += 32) {
+        __m256i a = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(src + x)), 8);
+        __m256i b = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *)(src + x + 16)), 8);
+        _mm256_storeu_si256((__m256i *)(dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+    }
+}
+#endif
+
+/*
+ * What a row generator draws: row y of a width x height plane of component
+ * plane (0 Y, 1 Cb, 2 Cr), as 16 bit samples.
+ */
+struct RowContext {
+    int plane;
+    int y;
+    int width, height;
+    int frame;
+    bool avx2;
+};
+
+static void gradient_row(uint16_t *dst, const RowContext &r)
+{
+    // Y = x + y + 3i, Cb = 128 + y + 2i, Cr = 64 + x + 5i, wrapping at 8 bits
+    int base = r.plane == 0 ? r.y + r.frame * 3 : r.plane == 1 ? 128 + r.y + r.frame * 2 : 64 + r.frame * 5;
+    int step = r.plane == 1 ? 0 : 1;
+    int x = 0;
+
+#if HAVE_X86
+    if (r.avx2) {
+        x = r.width & ~15;
+        gradient_row_avx2(dst, x, base, step);
+    }
+#endif
+    for (; x < r.width; x++)
+        dst[x] = ((base + step * x) & 255) << 8;
+}
+
+static void bars_row(uint16_t *dst, const RowContext &r)
+{
+    // one screen width every 100 frames
+    int offset = (int)((int64_t)r.frame * r.width / 100 % r.width);
+    int x = 0;
+
+    while (x < r.width) {
+        int pos = (x + offset) % r.width;
+        int bar = (int)((int64_t)pos * 8 / r.width);
+        int next = (int)(((int64_t)(bar + 1) * r.width + 7) / 8);
+        int run = FFMIN(next - pos, r.width - x);
+        std::fill_n(dst + x, run, (uint16_t)(bar_colors[bar][r.plane] << 8));
+        x += run;
+    }
+}
+
+static inline uint32_t noise_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static void noise_row(uint16_t *dst, const RowContext &r)
+{
+    uint32_t seed = noise_hash(r.frame * 3 + r.plane) ^ (r.y * 0x9e3779b1u);
+    int x = 0;
+
+#if HAVE_X86
+    if (r.avx2) {
+        x = r.width & ~15;
+        noise_row_avx2(dst, x, seed);
+    }
+#endif
+    for (; x < r.width; x++)
+        dst[x] = noise_hash(seed + x) >> 16;
+}
+
+static void zoneplate_row(uint16_t *dst, const RowContext &r)
+{
+    // the ring frequency grows with the radius up to Nyquist at the edge
+    int radius = FFMAX(FFMAX(r.width, r.height) / 2, 1);
+    float scale = (float)SINE_SIZE / (4 * radius);
+    float phase = (float)(-r.frame * 16);
+    int dy = r.y - r.height / 2;
+    int x = 0;
+
+    if (r.plane) {
+        std::fill_n(dst, r.width, (uint16_t)(128 << 8));
+        return;
+    }
+#if HAVE_X86
+    if (r.avx2) {
+        x = r.width & ~15;
+        zoneplate_row_avx2(dst, x, r.width / 2, dy * dy, scale, phase);
+    }
+#endif
+    for (; x < r.width; x++) {
+        int dx = x - r.width / 2;
+        dst[x] = sine.v[(int)((float)(dx * dx + dy * dy) * scale + phase) & (SINE_SIZE - 1)];
+    }
+}
+
+static void text_row(uint16_t *dst, const RowContext &r)
+{
+    char caption[32];
+    int len = snprintf(caption, sizeof(caption), "FRAME %06d", r.frame);
+    int size = FFMAX(r.height / 60, 1); // glyph pixel size
+    int advance = 6 * size;
+    int top = (r.height - 7 * size) / 2;
+    int glyph_row = r.y >= top ? (r.y - top) / size : -1;
+    int travel = r.width + len * advance;
+    int left = r.width - (int)((int64_t)r.frame * 2 * size % travel);
+
+    std::fill_n(dst, r.width, (uint16_t)(128 << 8));
+    if (r.plane || glyph_row < 0 || glyph_row >= 7)
+        return;
+
+    for (int i = 0; i < len; i++) {
+        const char *c = strchr(font_chars, caption[i]);
+        if (caption[i] == ' ' || !c)
+            continue;
+        uint8_t bits = font[c - font_chars][glyph_row];
+        for (int col = 0; col < 5; col++) {
+            if (!(bits & (0x10 >> col)))
+                continue;
+            int x0 = FFMAX(left + i * advance + col * size, 0);
+            int x1 = FFMIN(left + i * advance + (col + 1) * size, r.width);
+            if (x0 < x1)
+                std::fill_n(dst + x0, x1 - x0, (uint16_t)(235 << 8));
+        }
+    }
+}
+
+typedef void (*RowFunction)(uint16_t *dst, const RowContext &r);
+
+static const RowFunction row_functions[] = {
+    gradient_row,
+    bars_row,
+    noise_row,
+    zoneplate_row,
+    text_row,
+};
+
+static void pack_row(uint8_t *dst, const uint16_t *src, int n, const FormatInfo *format, bool avx2)
+{
+    int x = 0;
+
+    if (format->depth == 8) {
+#if HAVE_X86
+        if (avx2) {
+            x = n & ~31;
+            pack8_avx2(dst, src, x);
+        }
+#endif
+        for (; x < n; x++)
+            dst[x] = src[x] >> 8;
+    } else {
+        uint16_t *dst16 = (uint16_t *)dst;
+        int shift = 16 - format->depth;
+        uint16_t mask = format->msb ? (uint16_t)(0xffff << shift) : 0;
+        if (format->msb) {
+            for (; x < n; x++)
+                dst16[x] = src[x] & mask;
+        } else {
+            for (; x < n; x++)
+                dst16[x] = src[x] >> shift;
+        }
+    }
+}
+
+static void interleave_row(uint8_t *dst, const uint16_t *cb, const uint16_t *cr, int n,
+                           const FormatInfo *format)
+{
+    if (format->depth == 8) {
+        for (int x = 0; x < n; x++) {
+            dst[2 * x] = cb[x] >> 8;
+            dst[2 * x + 1] = cr[x] >> 8;
+        }
+    } else {
+        uint16_t *dst16 = (uint16_t *)dst;
+        uint16_t mask = (uint16_t)(0xffff << (16 - format->depth));
+        for (int x = 0; x < n; x++) {
+            dst16[2 * x] = cb[x] & mask;
+            dst16[2 * x + 1] = cr[x] & mask;
+        }
+    }
+}
+
+static void rgb_row(uint8_t *dst, const uint16_t *y, const uint16_t *cb, const uint16_t *cr, int n)
+{
+    // BT.601 limited range, 16.16 fixed point
+    for (int x = 0; x < n; x++) {
+        int l = ((y[x] >> 8) - 16) * 76309;
+        int u = (cb[x] >> 8) - 128;
+        int v = (cr[x] >> 8) - 128;
+        dst[3 * x] = av_clip_uint8((l + 104597 * v + 32768) >> 16);
+        dst[3 * x + 1] = av_clip_uint8((l - 25675 * u - 53279 * v + 32768) >> 16);
+        dst[3 * x + 2] = av_clip_uint8((l + 132201 * u + 32768) >> 16);
+    }
+}
+
+/* Draw luma rows [y0, y1); y0 is on the chroma grid. */
+static void fill_band(uint8_t *const data[4], const int linesize[4], const FormatInfo *format,
+                      int width, int height, RowFunction row, int frame, int y0, int y1)
+{
+    int chroma_w = AV_CEIL_RSHIFT(width, format->shift_w);
+    int chroma_h = AV_CEIL_RSHIFT(height, format->shift_h);
+    std::vector<uint16_t> buffer(3 * (size_t)width);
+    uint16_t *rows[3] = { buffer.data(), buffer.data() + width, buffer.data() + 2 * width };
+    RowContext r;
+
+    r.frame = frame;
+    r.avx2 = HAVE_X86 && (av_get_cpu_flags() & AV_CPU_FLAG_AVX2);
+
+    for (int y = y0; y < y1; y++) {
+        if (format->layout == LAYOUT_RGB24) {
+            for (r.plane = 0; r.plane < 3; r.plane++) {
+                r.y = y;
+                r.width = width;
+                r.height = height;
+                row(rows[r.plane], r);
+            }
+            rgb_row(data[0] + y * linesize[0], rows[0], rows[1], rows[2], width);
+            continue;
+        }
+
+        r.plane = 0;
+        r.y = y;
+        r.width = width;
+        r.height = height;
+        row(rows[0], r);
+        pack_row(data[0] + y * linesize[0], rows[0], width, format, r.avx2);
+
+        if (format->components == 1 || y & ((1 << format->shift_h) - 1))
+            continue;
+        r.y = y >> format->shift_h;
+        r.width = chroma_w;
+        r.height = chroma_h;
+        for (r.plane = 1; r.plane < 3; r.plane++)
+            row(rows[r.plane], r);
+        if (format->layout == LAYOUT_SEMIPLANAR) {
+            interleave_row(data[1] + r.y * linesize[1], rows[1], rows[2], chroma_w, format);
+        } else {
+            pack_row(data[1] + r.y * linesize[1], rows[1], chroma_w, format, r.avx2);
+            pack_row(data[2] + r.y * linesize[2], rows[2], chroma_w, format, r.avx2);
+        }
+    }
+}
+
+int test_pattern_from_name(enum TestPattern *pattern, const char *name)
+{
+    static const char *const names[] = { "gradient", "bars", "noise", "zoneplate", "text" };
+
+    for (size_t i = 0; i < FF_ARRAY_ELEMS(names); i++) {
+        if (!strcmp(name, names[i])) {
+            *pattern = (enum TestPattern)i;
+            return 0;
+        }
+    }
+    av_log(NULL, AV_LOG_ERROR, "Unknown test pattern '%s'\n", name);
+    return AVERROR(EINVAL);
+}
+
+static const FormatInfo *find_format(enum AVPixelFormat pix_fmt)
+{
+    for (const FormatInfo &format : formats)
+        if (format.pix_fmt == pix_fmt)
+            return &format;
+    return NULL;
+}
+
+bool test_pattern_supports(enum AVPixelFormat pix_fmt)
+{
+    return find_format(pix_fmt) != NULL;
+}
+
+int test_pattern_fill(uint8_t *const data[4], const int linesize[4], enum AVPixelFormat pix_fmt,
+                      int width, int height, enum TestPattern pattern, int frame_index, int threads)
+{
+    const FormatInfo *format = find_format(pix_fmt);
+    RowFunction row = row_functions[pattern];
+    std::vector<std::thread> workers;
+    int band;
+
+    if (!format) {
+        av_log(NULL, AV_LOG_ERROR, "No test patterns for %s\n", av_get_pix_fmt_name(pix_fmt));
+        return AVERROR(EINVAL);
+    }
+    if (width <= 0 || height <= 0)
+        return AVERROR(EINVAL);
+
+    if (threads <= 0)
+        threads = av_cpu_count();
+    threads = av_clip(threads, 1, FFMAX(height / MIN_BAND_ROWS, 1));
+    // bands start on the chroma grid so each chroma row has one owner
+    band = FFALIGN((height + threads - 1) / threads, 1 << format->shift_h);
+
+    for (int y0 = band; y0 < height; y0 += band)
+        workers.emplace_back(fill_band, data, linesize, format, width, height, row, frame_index,
+                             y0, FFMIN(y0 + band, height));
+    fill_band(data, linesize, format, width, height, row, frame_index, 0, FFMIN(band, height));
+    for (auto &worker : workers)
+        worker.join();
+    return 0;
+}
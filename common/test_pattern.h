@@ -0,0 +1,47 @@
+/**
+ * @file synthetic test pictures
+ *
+ * Moving test patterns for encoder and scaler benchmarks, generated fast
+ * enough that the benchmark measures the encoder and not the generator: rows
+ * come from AVX2 kernels when the CPU has them, and a frame is filled in
+ * horizontal bands by several threads.
+ *
+ * Every pattern is generated as 16 bit Y, Cb and Cr rows and then packed,
+ * so all patterns work with all the supported formats: gray, 8 and 10 bit
+ * planar YUV 4:2:0, 4:2:2 and 4:4:4, NV12, P010 and RGB24 (BT.601).
+ */
+#ifndef TEST_PATTERN_H
+#define TEST_PATTERN_H
+
+#include <stdint.h>
+extern "C"
+{
+#include <libavutil/pixfmt.h>
+}
+
+enum TestPattern {
+    TEST_PATTERN_GRADIENT, ///< the diagonal ramps of the FFmpeg encode and scale examples
+    TEST_PATTERN_BARS, ///< 75% colour bars scrolling to the left
+    TEST_PATTERN_NOISE, ///< uniform noise in every plane, different every frame
+    TEST_PATTERN_ZONEPLATE, ///< circular zone plate with rings moving outwards
+    TEST_PATTERN_TEXT, ///< the frame number scrolling over mid grey
+};
+
+/**
+ * Look up gradient, bars, noise, zoneplate or text. Returns AVERROR(EINVAL)
+ * for other names.
+ */
+int test_pattern_from_name(enum TestPattern *pattern, const char *name);
+
+bool test_pattern_supports(enum AVPixelFormat pix_fmt);
+
+/**
+ * Draw frame frame_index of pattern into a width x height picture.
+ *
+ * @param threads  number of threads filling bands of rows, 0 for one per CPU
+ * @return 0, or AVERROR(EINVAL) if pix_fmt is not supported
+ */
+int test_pattern_fill(uint8_t *const data[4], const int linesize[4], enum AVPixelFormat pix_fmt,
+                      int width, int height, enum TestPattern pattern, int frame_index, int threads);
+
+#endif /* TEST_PATTERN_H */
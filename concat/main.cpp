@@ -0,0 +1,346 @@
+// lossless concatenation built on the remuxing packet loop: packets of every
+// input are copied to one output, timestamps rebased so they keep increasing
+extern "C"
+{
+#include <libavutil/mathematics.h>
+#include <libavutil/timestamp.h>
+#include <libavformat/avformat.h>
+}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+// packets read ahead of each input to find the first dts of its streams
+#define PROBE_PACKETS 64
+
+static int is_copied_stream(const AVCodecParameters *codecpar)
+{
+    return codecpar->codec_type == AVMEDIA_TYPE_AUDIO ||
+           codecpar->codec_type == AVMEDIA_TYPE_VIDEO ||
+           codecpar->codec_type == AVMEDIA_TYPE_SUBTITLE;
+}
+
+/*
+ * Packets are copied as is, so every input must carry the same streams, in
+ * the same order, with parameters a decoder of the first input's streams can
+ * take without being reinitialized.
+ */
+static int check_compatible(const AVCodecParameters *a, const AVCodecParameters *b, int index, const char *filename)
+{
+    const char *reason = NULL;
+
+    if (a->codec_type != b->codec_type)
+        reason = "media type";
+    else if (a->codec_id != b->codec_id)
+        reason = "codec";
+    else if (a->codec_type == AVMEDIA_TYPE_VIDEO &&
+             (a->width != b->width || a->height != b->height || a->format != b->format))
+        reason = "picture size or pixel format";
+    else if (a->codec_type == AVMEDIA_TYPE_AUDIO &&
+             (a->sample_rate != b->sample_rate || a->ch_layout.nb_channels != b->ch_layout.nb_channels))
+        reason = "sample rate or channel count";
+    else if (a->extradata_size != b->extradata_size ||
+             (a->extradata_size && memcmp(a->extradata, b->extradata, a->extradata_size)))
+        reason = "codec extradata";
+
+    if (reason)
+    {
+        fprintf(stderr, "Stream #%d of '%s' differs from the first input in %s\n", index, filename, reason);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    AVFormatContext *input_format_context = NULL, *output_format_context = NULL;
+    AVPacket packet;
+    const char *in_filename, *out_filename;
+    int ret = 0, i, input;
+    int stream_index;
+    int *streams_list = NULL;
+    int number_of_streams = 0;
+    int number_of_output_streams = 0;
+    // per output stream, in the output time base
+    int64_t *last_dts = NULL;
+    int64_t *end_ts = NULL;
+    // where the current input starts in the output, in AV_TIME_BASE
+    int64_t offset = 0;
+    int64_t input_start;
+    // read ahead of the current input, written before reading on
+    AVPacket *probed[PROBE_PACKETS] = { NULL };
+    int nb_probed = 0, next_probed = 0, probe_ret;
+    int *dts_seen = NULL;
+
+    if (argc < 4)
+    {
+        printf("usage: %s <output> <input 1> <input 2> [<input 3> ...]\n", argv[0]);
+        return -1;
+    }
+    out_filename = argv[1];
+
+    avformat_alloc_output_context2(&output_format_context, NULL, NULL, out_filename);
+    if (!output_format_context)
+    {
+        fprintf(stderr, "Could not create output context\n");
+        ret = AVERROR_UNKNOWN;
+        goto end;
+    }
+
+    for (input = 2; input < argc; input++)
+    {
+        in_filename = argv[input];
+
+        if ((ret = avformat_open_input(&input_format_context, in_filename, NULL, NULL)) < 0)
+        {
+            fprintf(stderr, "Could not open input file '%s'", in_filename);
+            goto end;
+        }
+        if ((ret = avformat_find_stream_info(input_format_context, NULL)) < 0)
+        {
+            fprintf(stderr, "Failed to retrieve input stream information");
+            goto end;
+        }
+
+        number_of_streams = input_format_context->nb_streams;
+        av_freep(&streams_list);
+        streams_list = (int *)av_malloc_array(number_of_streams, sizeof(*streams_list));
+        if (!streams_list)
+        {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+
+        stream_index = 0;
+        for (i = 0; i < input_format_context->nb_streams; i++)
+        {
+            AVStream *out_stream;
+            AVStream *in_stream = input_format_context->streams[i];
+            AVCodecParameters *in_codecpar = in_stream->codecpar;
+            if (!is_copied_stream(in_codecpar))
+            {
+                streams_list[i] = -1;
+                continue;
+            }
+            streams_list[i] = stream_index++;
+
+            // the first input defines the output layout, the others must match it
+            if (input > 2)
+            {
+                if (streams_list[i] >= number_of_output_streams)
+                {
+                    fprintf(stderr, "'%s' has more streams than the first input\n", in_filename);
+                    ret = AVERROR(EINVAL);
+                    goto end;
+                }
+                ret = check_compatible(output_format_context->streams[streams_list[i]]->codecpar, in_codecpar, i, in_filename);
+                if (ret < 0)
+                    goto end;
+                continue;
+            }
+
+            out_stream = avformat_new_stream(output_format_context, NULL);
+            if (!out_stream)
+            {
+                fprintf(stderr, "Failed allocating output stream\n");
+                ret = AVERROR_UNKNOWN;
+                goto end;
+            }
+            ret = avcodec_parameters_copy(out_stream->codecpar, in_codecpar);
+            if (ret < 0)
+            {
+                fprintf(stderr, "Failed to copy codec parameters\n");
+                goto end;
+            }
+            out_stream->time_base = in_stream->time_base;
+        }
+        if (input > 2 && stream_index != number_of_output_streams)
+        {
+            fprintf(stderr, "'%s' has fewer streams than the first input\n", in_filename);
+            ret = AVERROR(EINVAL);
+            goto end;
+        }
+
+        if (input == 2)
+        {
+            number_of_output_streams = stream_index;
+            last_dts = (int64_t *)av_malloc_array(number_of_output_streams, sizeof(*last_dts));
+            end_ts = (int64_t *)av_calloc(number_of_output_streams, sizeof(*end_ts));
+            dts_seen = (int *)av_calloc(number_of_output_streams, sizeof(*dts_seen));
+            if (!last_dts || !end_ts || !dts_seen)
+            {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            for (i = 0; i < number_of_output_streams; i++)
+                last_dts[i] = AV_NOPTS_VALUE;
+
+            av_dump_format(output_format_context, 0, out_filename, 1);
+
+            if (!(output_format_context->oformat->flags & AVFMT_NOFILE))
+            {
+                ret = avio_open(&output_format_context->pb, out_filename, AVIO_FLAG_WRITE);
+                if (ret < 0)
+                {
+                    fprintf(stderr, "Could not open output file '%s'", out_filename);
+                    goto end;
+                }
+            }
+            ret = avformat_write_header(output_format_context, NULL);
+            if (ret < 0)
+            {
+                fprintf(stderr, "Error occurred when opening output file\n");
+                goto end;
+            }
+        }
+        else
+        {
+            // continue where the longest stream of the previous inputs ended,
+            // so audio and video of one clip stay in sync
+            for (i = 0; i < number_of_output_streams; i++)
+            {
+                int64_t end = av_rescale_q(end_ts[i], output_format_context->streams[i]->time_base, AV_TIME_BASE_Q);
+                if (end > offset)
+                    offset = end;
+            }
+        }
+        input_start = input_format_context->start_time != AV_NOPTS_VALUE ? input_format_context->start_time : 0;
+
+        // offset lines up presentation times, but streams with B-frames start
+        // decoding a few frames before their first pts: look at the first dts
+        // of every stream and delay the whole input until none of them falls
+        // at or before what the previous inputs wrote, so pts and dts move
+        // together and the presentation order within the input is kept
+        memset(dts_seen, 0, number_of_output_streams * sizeof(*dts_seen));
+        nb_probed = next_probed = 0;
+        probe_ret = 0;
+        for (i = 0; i < number_of_output_streams && nb_probed < PROBE_PACKETS; )
+        {
+            AVPacket *pkt = av_packet_alloc();
+            AVStream *in_stream, *out_stream;
+            int64_t dts, lead;
+            int index;
+            if (!pkt)
+            {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            probed[nb_probed++] = pkt;
+            if ((probe_ret = av_read_frame(input_format_context, pkt)) < 0)
+                break;
+            if (pkt->stream_index >= number_of_streams || streams_list[pkt->stream_index] < 0 ||
+                pkt->dts == AV_NOPTS_VALUE || dts_seen[streams_list[pkt->stream_index]])
+                continue;
+            in_stream = input_format_context->streams[pkt->stream_index];
+            index = streams_list[pkt->stream_index];
+            out_stream = output_format_context->streams[index];
+            dts_seen[index] = 1;
+            i++;
+            if (last_dts[index] == AV_NOPTS_VALUE)
+                continue;
+            dts = av_rescale_q(pkt->dts, in_stream->time_base, out_stream->time_base) +
+                  av_rescale_q(offset - input_start, AV_TIME_BASE_Q, out_stream->time_base);
+            lead = last_dts[index] + 1 - dts;
+            if (lead > 0)
+                offset += av_rescale_q_rnd(lead, out_stream->time_base, AV_TIME_BASE_Q, AV_ROUND_UP);
+        }
+        printf("%s: starts at %.3f s in the output\n", in_filename, offset / (double)AV_TIME_BASE);
+
+        while (1)
+        {
+            AVStream *in_stream, *out_stream;
+            int64_t shift;
+            if (next_probed < nb_probed)
+            {
+                AVPacket *pkt = probed[next_probed++];
+                // the last probed packet is where reading stopped
+                if (next_probed == nb_probed && probe_ret < 0)
+                {
+                    ret = probe_ret;
+                    break;
+                }
+                av_packet_move_ref(&packet, pkt);
+                ret = 0;
+            }
+            else
+            {
+                ret = av_read_frame(input_format_context, &packet);
+            }
+            if (ret < 0)
+                break;
+            in_stream = input_format_context->streams[packet.stream_index];
+            if (packet.stream_index >= number_of_streams || streams_list[packet.stream_index] < 0)
+            {
+                av_packet_unref(&packet);
+                continue;
+            }
+            packet.stream_index = streams_list[packet.stream_index];
+            out_stream = output_format_context->streams[packet.stream_index];
+            shift = av_rescale_q(offset - input_start, AV_TIME_BASE_Q, out_stream->time_base);
+            /* copy packet */
+            packet.pts = av_rescale_q_rnd(packet.pts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+            packet.dts = av_rescale_q_rnd(packet.dts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+            packet.duration = av_rescale_q(packet.duration, in_stream->time_base, out_stream->time_base);
+            if (packet.pts != AV_NOPTS_VALUE)
+                packet.pts += shift;
+            if (packet.dts != AV_NOPTS_VALUE)
+                packet.dts += shift;
+
+            // the input as a whole is already past the previous one, this
+            // only catches rounding; pts is left alone unless it would fall
+            // behind dts
+            if (packet.dts != AV_NOPTS_VALUE && last_dts[packet.stream_index] != AV_NOPTS_VALUE &&
+                packet.dts <= last_dts[packet.stream_index])
+            {
+                packet.dts = last_dts[packet.stream_index] + 1;
+                if (packet.pts != AV_NOPTS_VALUE && packet.pts < packet.dts)
+                    packet.pts = packet.dts;
+            }
+            if (packet.dts != AV_NOPTS_VALUE)
+            {
+                last_dts[packet.stream_index] = packet.dts;
+                if (packet.dts + packet.duration > end_ts[packet.stream_index])
+                    end_ts[packet.stream_index] = packet.dts + packet.duration;
+            }
+            if (packet.pts != AV_NOPTS_VALUE && packet.pts + packet.duration > end_ts[packet.stream_index])
+                end_ts[packet.stream_index] = packet.pts + packet.duration;
+            packet.pos = -1;
+
+            ret = av_interleaved_write_frame(output_format_context, &packet);
+            if (ret < 0)
+            {
+                fprintf(stderr, "Error muxing packet\n");
+                av_packet_unref(&packet);
+                goto end;
+            }
+            av_packet_unref(&packet);
+        }
+        if (ret != AVERROR_EOF)
+            goto end;
+        for (i = 0; i < nb_probed; i++)
+            av_packet_free(&probed[i]);
+        avformat_close_input(&input_format_context);
+    }
+
+    ret = av_write_trailer(output_format_context);
+
+end:
+    avformat_close_input(&input_format_context);
+    /* close output */
+    if (output_format_context && !(output_format_context->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&output_format_context->pb);
+    avformat_free_context(output_format_context);
+    av_freep(&streams_list);
+    av_freep(&last_dts);
+    av_freep(&end_ts);
+    av_freep(&dts_seen);
+    for (i = 0; i < PROBE_PACKETS; i++)
+        av_packet_free(&probed[i]);
+    if (ret < 0 && ret != AVERROR_EOF)
+    {
+        fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+/**
+ * Contact sheet / sprite sheet generator for scrubbing previews: N frames
+ * sampled uniformly over the video are downscaled into the tiles of a single
+ * grid image, and a WebVTT file maps every time range to its tile with
+ * "sheet.jpg#xywh=x,y,w,h" cues, the format players use for thumbnails.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <string>
+extern "C"
+{
+    #include <libavcodec/avcodec.h>
+    #include <libavformat/avformat.h>
+    #include <libavutil/imgutils.h>
+    #include <libavutil/pixdesc.h>
+    #include <libswscale/swscale.h>
+}
+#include "packet_index.h"
+
+struct SheetOptions {
+    int count = 100; ///< number of tiles
+    int columns = 10;
+    int tile_width = 160; ///< tile height follows the display aspect ratio
+    int quality = -1; ///< jpeg quality 1-100, -1 for the encoder default
+};
+
+static int64_t seconds_to_timestamp(const AVStream *st, double seconds)
+{
+    int64_t timestamp = av_rescale_q((int64_t)(seconds * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+    if (st->start_time != AV_NOPTS_VALUE)
+        timestamp += st->start_time;
+    return timestamp;
+}
+
+static void format_vtt_time(char *buf, size_t size, double seconds)
+{
+    int64_t ms = (int64_t)(seconds * 1000 + 0.5);
+    snprintf(buf, size, "%02d:%02d:%02d.%03d", (int)(ms / 3600000), (int)(ms / 60000 % 60),
+             (int)(ms / 1000 % 60), (int)(ms % 1000));
+}
+
+/*
+ * Seek to the keyframe before timestamp and decode up to the first frame
+ * shown at or after it. A sample past the last frame returns the last one.
+ */
+static int decode_frame_at(AVFormatContext *fmt_ctx, const PacketIndex *index, AVCodecContext *ctx,
+                           AVPacket *pkt, int video_stream, int64_t timestamp, AVFrame *fr)
+{
+    AVFrame *next;
+    int result;
+
+    if (index->header)
+        result = packet_index_seek(fmt_ctx, index, video_stream, timestamp);
+    else
+        result = av_seek_frame(fmt_ctx, video_stream, timestamp, AVSEEK_FLAG_BACKWARD);
+    if (result < 0)
+        return result;
+    avcodec_flush_buffers(ctx);
+
+    next = av_frame_alloc();
+    if (!next)
+        return AVERROR(ENOMEM);
+    // fr always holds the latest frame decoded, which is what EOF returns
+    av_frame_unref(fr);
+    while (1) {
+        result = avcodec_receive_frame(ctx, next);
+        if (result >= 0) {
+            av_frame_unref(fr);
+            av_frame_move_ref(fr, next);
+            if (fr->pts == AV_NOPTS_VALUE || fr->pts >= timestamp)
+                break;
+            continue;
+        }
+        if (result == AVERROR_EOF) {
+            if (fr->buf[0])
+                result = 0;
+            break;
+        }
+        if (result != AVERROR(EAGAIN))
+            break;
+
+        while ((result = av_read_frame(fmt_ctx, pkt)) >= 0 && pkt->stream_index != video_stream)
+            av_packet_unref(pkt);
+        result = avcodec_send_packet(ctx, result < 0 ? NULL : pkt);
+        av_packet_unref(pkt);
+        if (result < 0 && result != AVERROR_EOF)
+            break;
+    }
+    av_frame_free(&next);
+    return result;
+}
+
+/* Point dst at (x, y) of every plane of sheet. x and y must be even. */
+static void tile_pointers(const AVFrame *sheet, int x, int y, uint8_t *dst[4])
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((enum AVPixelFormat)sheet->format);
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (!sheet->data[i]) {
+            dst[i] = NULL;
+            continue;
+        }
+        int shift_w = (i == 1 || i == 2) ? desc->log2_chroma_w : 0;
+        int shift_h = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+        int step = (desc->flags & AV_PIX_FMT_FLAG_PLANAR) ? desc->comp[i].step : desc->comp[0].step;
+        dst[i] = sheet->data[i] + (y >> shift_h) * sheet->linesize[i] + (x >> shift_w) * step;
+    }
+}
+
+static int write_sheet(AVFrame *sheet, const char *filename, enum AVCodecID codec_id, int quality)
+{
+    const AVCodec *codec = avcodec_find_encoder(codec_id);
+    AVCodecContext *enc = NULL;
+    AVPacket *pkt = NULL;
+    FILE *f;
+    int result;
+
+    if (!codec) {
+        av_log(NULL, AV_LOG_ERROR, "Can't find image encoder\n");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    enc = avcodec_alloc_context3(codec);
+    pkt = av_packet_alloc();
+    if (!enc || !pkt) {
+        result = AVERROR(ENOMEM);
+        goto end;
+    }
+    enc->width = sheet->width;
+    enc->height = sheet->height;
+    enc->pix_fmt = (enum AVPixelFormat)sheet->format;
+    enc->time_base = (AVRational){1, 25};
+    if (codec_id == AV_CODEC_ID_MJPEG && quality > 0) {
+        enc->flags |= AV_CODEC_FLAG_QSCALE;
+        enc->global_quality = FF_QP2LAMBDA * (31 - (FFMIN(quality, 100) - 1) * 29 / 99);
+    }
+    if ((result = avcodec_open2(enc, codec, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open image encoder\n");
+        goto end;
+    }
+
+    sheet->quality = enc->global_quality;
+    if ((result = avcodec_send_frame(enc, sheet)) < 0 ||
+        (result = avcodec_receive_packet(enc, pkt)) < 0)
+        goto end;
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open %s\n", filename);
+        result = AVERROR(errno);
+        goto end;
+    }
+    fwrite(pkt->data, 1, pkt->size, f);
+    fclose(f);
+
+end:
+    av_packet_free(&pkt);
+    avcodec_free_context(&enc);
+    return result;
+}
+
+static int make_contact_sheet(const char *input_filename, const char *output_filename,
+                              const char *vtt_filename, const SheetOptions &options)
+{
+    const AVCodec *codec = NULL;
+    AVCodecContext *ctx = NULL;
+    AVFormatContext *fmt_ctx = NULL;
+    struct SwsContext *sws_ctx = NULL;
+    AVFrame *fr = NULL, *sheet = NULL;
+    AVPacket *pkt = NULL;
+    AVStream *st;
+    PacketIndex packet_index = {};
+    char *index_filename;
+    FILE *vtt = NULL;
+    const char *extension, *image_name;
+    enum AVCodecID codec_id;
+    AVRational sar;
+    ptrdiff_t sheet_linesize[4];
+    double duration;
+    int video_stream, tile_width, tile_height, rows, i, tiles = 0;
+    int result;
+
+    extension = strrchr(output_filename, '.');
+    if (extension && (!strcmp(extension, ".jpg") || !strcmp(extension, ".jpeg")))
+        codec_id = AV_CODEC_ID_MJPEG;
+    else
+        codec_id = AV_CODEC_ID_PNG;
+
+    result = avformat_open_input(&fmt_ctx, input_filename, NULL, NULL);
+    if (result < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open file\n");
+        return result;
+    }
+    result = avformat_find_stream_info(fmt_ctx, NULL);
+    if (result < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't get stream info\n");
+        goto end;
+    }
+    video_stream = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (video_stream < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't find video stream in input file\n");
+        result = video_stream;
+        goto end;
+    }
+    st = fmt_ctx->streams[video_stream];
+
+    if (st->duration != AV_NOPTS_VALUE)
+        duration = st->duration * av_q2d(st->time_base);
+    else if (fmt_ctx->duration != AV_NOPTS_VALUE)
+        duration = fmt_ctx->duration / (double)AV_TIME_BASE;
+    else {
+        av_log(NULL, AV_LOG_ERROR, "Input duration is unknown, can't sample it uniformly\n");
+        result = AVERROR(EINVAL);
+        goto end;
+    }
+
+    codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec) {
+        av_log(NULL, AV_LOG_ERROR, "Can't find decoder\n");
+        result = AVERROR_DECODER_NOT_FOUND;
+        goto end;
+    }
+    ctx = avcodec_alloc_context3(codec);
+    fr = av_frame_alloc();
+    sheet = av_frame_alloc();
+    pkt = av_packet_alloc();
+    if (!ctx || !fr || !sheet || !pkt) {
+        result = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((result = avcodec_parameters_to_context(ctx, st->codecpar)) < 0 ||
+        (result = avcodec_open2(ctx, codec, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open decoder\n");
+        goto end;
+    }
+
+    // tiles keep the display aspect ratio; even sizes keep chroma aligned
+    sar = av_guess_sample_aspect_ratio(fmt_ctx, st, NULL);
+    if (sar.num <= 0 || sar.den <= 0)
+        sar = (AVRational){1, 1};
+    tile_width = options.tile_width & ~1;
+    tile_height = (int)av_rescale(tile_width, (int64_t)ctx->height * sar.den, (int64_t)ctx->width * sar.num) & ~1;
+    if (tile_width <= 0 || tile_height <= 0) {
+        av_log(NULL, AV_LOG_ERROR, "Invalid tile size\n");
+        result = AVERROR(EINVAL);
+        goto end;
+    }
+    rows = (options.count + options.columns - 1) / options.columns;
+
+    sheet->format = codec_id == AV_CODEC_ID_MJPEG ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_RGB24;
+    sheet->width = tile_width * FFMIN(options.count, options.columns);
+    sheet->height = tile_height * rows;
+    if ((result = av_frame_get_buffer(sheet, 0)) < 0)
+        goto end;
+    for (i = 0; i < 4; i++)
+        sheet_linesize[i] = sheet->linesize[i];
+    av_image_fill_black(sheet->data, sheet_linesize, (enum AVPixelFormat)sheet->format,
+                        AVCOL_RANGE_JPEG, sheet->width, sheet->height);
+
+    index_filename = packet_index_filename(input_filename);
+    if (index_filename)
+        packet_index_load(&packet_index, index_filename);
+    av_free(index_filename);
+
+    vtt = fopen(vtt_filename, "w");
+    if (!vtt) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open %s\n", vtt_filename);
+        result = AVERROR(errno);
+        goto end;
+    }
+    fprintf(vtt, "WEBVTT\n\n");
+    // cues reference the image relative to the vtt file
+    image_name = strrchr(output_filename, '/');
+    image_name = image_name ? image_name + 1 : output_filename;
+
+    for (i = 0; i < options.count; i++) {
+        double from = duration * i / options.count;
+        double to = duration * (i + 1) / options.count;
+        int x = (i % options.columns) * tile_width;
+        int y = (i / options.columns) * tile_height;
+        uint8_t *dst[4];
+        int dst_linesize[4] = { sheet->linesize[0], sheet->linesize[1], sheet->linesize[2], sheet->linesize[3] };
+        char from_str[32], to_str[32];
+
+        // sample the middle of each time range
+        result = decode_frame_at(fmt_ctx, &packet_index, ctx, pkt, video_stream,
+                                 seconds_to_timestamp(st, (from + to) / 2), fr);
+        if (result < 0) {
+            av_log(NULL, AV_LOG_WARNING, "No frame at %.3f s, tile %d left blank\n", (from + to) / 2, i);
+        } else {
+            // one context for the whole sheet, only rebuilt if the input changes size or format
+            sws_ctx = sws_getCachedContext(sws_ctx, fr->width, fr->height, (enum AVPixelFormat)fr->format,
+                                           tile_width, tile_height, (enum AVPixelFormat)sheet->format,
+                                           SWS_AREA, NULL, NULL, NULL);
+            if (!sws_ctx) {
+                av_log(NULL, AV_LOG_ERROR, "Cannot initialize the conversion context\n");
+                result = AVERROR(EINVAL);
+                goto end;
+            }
+            tile_pointers(sheet, x, y, dst);
+            sws_scale(sws_ctx, (const uint8_t * const *)fr->data, fr->linesize, 0, fr->height, dst, dst_linesize);
+            av_frame_unref(fr);
+            tiles++;
+        }
+
+        format_vtt_time(from_str, sizeof(from_str), from);
+        format_vtt_time(to_str, sizeof(to_str), to);
+        fprintf(vtt, "%s --> %s\n%s#xywh=%d,%d,%d,%d\n\n", from_str, to_str, image_name,
+                x, y, tile_width, tile_height);
+    }
+
+    qDebug() << "sheet" << sheet->width << "x" << sheet->height << ":" << tiles << "of" << options.count << "tiles";
+    result = write_sheet(sheet, output_filename, codec_id, options.quality);
+
+end:
+    if (vtt)
+        fclose(vtt);
+    packet_index_free(&packet_index);
+    sws_freeContext(sws_ctx);
+    av_packet_free(&pkt);
+    av_frame_free(&fr);
+    av_frame_free(&sheet);
+    avcodec_free_context(&ctx);
+    avformat_close_input(&fmt_ctx);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app (argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Tile frames sampled uniformly over a video into one image, with a\n"
+                                     "WebVTT map of the tiles for player scrubbing previews.");
+    SheetOptions options;
+
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Input video file.");
+    parser.addPositionalArgument("output", "Output image, .png or .jpg.");
+    parser.addPositionalArgument("vtt", "Output WebVTT file, <output>.vtt by default.", "[vtt]");
+    QCommandLineOption countOption("count", "Number of tiles, 100 by default.", "count");
+    parser.addOption(countOption);
+    QCommandLineOption columnsOption("columns", "Tiles per row, 10 by default.", "columns");
+    parser.addOption(columnsOption);
+    QCommandLineOption widthOption("tile-width", "Tile width in pixels, 160 by default.", "width");
+    parser.addOption(widthOption);
+    QCommandLineOption qualityOption("quality", "JPEG quality 1-100.", "quality");
+    parser.addOption(qualityOption);
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() < 2)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Incorrect input\n");
+        return 1;
+    }
+    if (parser.isSet(countOption))
+        options.count = parser.value(countOption).toInt();
+    if (parser.isSet(columnsOption))
+        options.columns = parser.value(columnsOption).toInt();
+    if (parser.isSet(widthOption))
+        options.tile_width = parser.value(widthOption).toInt();
+    if (parser.isSet(qualityOption))
+        options.quality = parser.value(qualityOption).toInt();
+    if (options.count <= 0 || options.columns <= 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Tile count and columns must be positive\n");
+        return 1;
+    }
+
+    const QByteArray input_filename = args.at(0).toLocal8Bit();
+    const QByteArray output_filename = args.at(1).toLocal8Bit();
+    const QByteArray vtt_filename = args.size() > 2 ? args.at(2).toLocal8Bit() : output_filename + ".vtt";
+    if (make_contact_sheet(input_filename.constData(), output_filename.constData(),
+                           vtt_filename.constData(), options) < 0)
+        return 1;
+
+    return 0;
+}
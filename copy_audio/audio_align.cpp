@@ -0,0 +1,234 @@
+#include "audio_align.h"
+
+#include <QDebug>
+#include <vector>
+extern "C" {
+    #include <libavformat/avformat.h>
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/channel_layout.h>
+    #include <libavutil/tx.h>
+    #include <libswresample/swresample.h>
+}
+
+// correlation runs on a low rate mono mixdown of the first seconds of each
+// track, that is plenty to place speech or claps to the millisecond range
+// and keeps the transform small
+#define ALIGN_SAMPLE_RATE 8000
+#define ALIGN_WINDOW_SECONDS 30
+#define ALIGN_MAX_LAG_SECONDS 10
+
+/*
+ * Decode the first ALIGN_WINDOW_SECONDS of an audio stream into mono float
+ * samples at ALIGN_SAMPLE_RATE. start_time is set to the time of the first
+ * sample, in seconds.
+ */
+static int decode_window(const char *filename, int stream_index, std::vector<float> &samples, double *start_time)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *ctx = NULL;
+    const AVCodec *codec;
+    SwrContext *swr = NULL;
+    AVPacket *pkt = NULL;
+    AVFrame *frame = NULL;
+    AVStream *st;
+    AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+    const size_t wanted = ALIGN_WINDOW_SECONDS * ALIGN_SAMPLE_RATE;
+    int ret;
+
+    samples.clear();
+    *start_time = 0;
+
+    if ((ret = avformat_open_input(&fmt_ctx, filename, NULL, NULL)) < 0)
+        return ret;
+    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+        goto end;
+    if (stream_index < 0 || stream_index >= (int)fmt_ctx->nb_streams) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    st = fmt_ctx->streams[stream_index];
+
+    codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec) {
+        ret = AVERROR_DECODER_NOT_FOUND;
+        goto end;
+    }
+    ctx = avcodec_alloc_context3(codec);
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!ctx || !pkt || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = avcodec_parameters_to_context(ctx, st->codecpar)) < 0)
+        goto end;
+    ctx->pkt_timebase = st->time_base;
+    if ((ret = avcodec_open2(ctx, codec, NULL)) < 0)
+        goto end;
+
+    while (samples.size() < wanted && (ret = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        ret = avcodec_send_packet(ctx, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            goto end;
+
+        while ((ret = avcodec_receive_frame(ctx, frame)) >= 0) {
+            uint8_t *out;
+            int out_count;
+
+            // the decoder only knows the actual layout once it has output
+            if (!swr) {
+                ret = swr_alloc_set_opts2(&swr, &mono, AV_SAMPLE_FMT_FLT, ALIGN_SAMPLE_RATE,
+                                          &frame->ch_layout, (enum AVSampleFormat)frame->format,
+                                          frame->sample_rate, 0, NULL);
+                if (ret < 0 || (ret = swr_init(swr)) < 0)
+                    goto end;
+                if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+                    *start_time = frame->best_effort_timestamp * av_q2d(st->time_base);
+            }
+
+            out_count = swr_get_out_samples(swr, frame->nb_samples);
+            samples.resize(samples.size() + out_count);
+            out = (uint8_t *)(samples.data() + samples.size() - out_count);
+            ret = swr_convert(swr, &out, out_count, (const uint8_t **)frame->extended_data, frame->nb_samples);
+            av_frame_unref(frame);
+            if (ret < 0)
+                goto end;
+            samples.resize(samples.size() - out_count + ret);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            goto end;
+    }
+    if (swr) {
+        // drain what the resampler's filter still holds back
+        int out_count = swr_get_out_samples(swr, 0);
+        if (out_count > 0) {
+            uint8_t *out;
+            samples.resize(samples.size() + out_count);
+            out = (uint8_t *)(samples.data() + samples.size() - out_count);
+            ret = swr_convert(swr, &out, out_count, NULL, 0);
+            if (ret < 0)
+                goto end;
+            samples.resize(samples.size() - out_count + ret);
+        }
+    }
+    if (samples.size() > wanted)
+        samples.resize(wanted);
+    ret = samples.empty() ? AVERROR_INVALIDDATA : 0;
+
+end:
+    swr_free(&swr);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&ctx);
+    avformat_close_input(&fmt_ctx);
+    return ret;
+}
+
+/*
+ * Lag, in samples, at which x best matches reference: x[n] ~ reference[n + lag].
+ * Computed as the peak of the circular cross-correlation, through real FFTs
+ * from libavutil (SIMD optimized), over a length that avoids wrap-around.
+ */
+static int cross_correlate(const std::vector<float> &reference, const std::vector<float> &x, int max_lag, int *lag)
+{
+    AVTXContext *forward = NULL, *inverse = NULL;
+    av_tx_fn forward_fn, inverse_fn;
+    float scale = 1.0f;
+    float *ref_buf = NULL, *x_buf = NULL, *corr = NULL;
+    AVComplexFloat *ref_spec = NULL, *x_spec = NULL;
+    double ref_mean = 0, x_mean = 0;
+    float best = -1.0f;
+    int len = 1, i, ret;
+
+    while (len < (int)(reference.size() + x.size()))
+        len <<= 1;
+    max_lag = FFMIN(max_lag, len / 2 - 1);
+
+    if ((ret = av_tx_init(&forward, &forward_fn, AV_TX_FLOAT_RDFT, 0, len, &scale, 0)) < 0 ||
+        (ret = av_tx_init(&inverse, &inverse_fn, AV_TX_FLOAT_RDFT, 1, len, &scale, 0)) < 0)
+        goto end;
+
+    ref_buf = (float *)av_calloc(len + 2, sizeof(float));
+    x_buf = (float *)av_calloc(len + 2, sizeof(float));
+    corr = (float *)av_calloc(len + 2, sizeof(float));
+    ref_spec = (AVComplexFloat *)av_calloc(len / 2 + 1, sizeof(AVComplexFloat));
+    x_spec = (AVComplexFloat *)av_calloc(len / 2 + 1, sizeof(AVComplexFloat));
+    if (!ref_buf || !x_buf || !corr || !ref_spec || !x_spec) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    // remove DC so the peak reflects the signal and not the offsets
+    for (float v : reference)
+        ref_mean += v;
+    ref_mean /= reference.size();
+    for (float v : x)
+        x_mean += v;
+    x_mean /= x.size();
+    for (i = 0; i < (int)reference.size(); i++)
+        ref_buf[i] = reference[i] - ref_mean;
+    for (i = 0; i < (int)x.size(); i++)
+        x_buf[i] = x[i] - x_mean;
+
+    forward_fn(forward, ref_spec, ref_buf, sizeof(float));
+    forward_fn(forward, x_spec, x_buf, sizeof(float));
+    // reference * conj(x) -> correlation of reference against x
+    for (i = 0; i <= len / 2; i++) {
+        AVComplexFloat a = ref_spec[i], b = x_spec[i];
+        ref_spec[i].re = a.re * b.re + a.im * b.im;
+        ref_spec[i].im = a.im * b.re - a.re * b.im;
+    }
+    inverse_fn(inverse, corr, ref_spec, sizeof(AVComplexFloat));
+
+    // positive lags at the start of the buffer, negative ones wrapped at the end
+    *lag = 0;
+    for (i = -max_lag; i <= max_lag; i++) {
+        float v = corr[i >= 0 ? i : len + i];
+        if (v > best) {
+            best = v;
+            *lag = i;
+        }
+    }
+    ret = 0;
+
+end:
+    av_tx_uninit(&forward);
+    av_tx_uninit(&inverse);
+    av_free(ref_buf);
+    av_free(x_buf);
+    av_free(corr);
+    av_free(ref_spec);
+    av_free(x_spec);
+    return ret;
+}
+
+int find_audio_offset(const char *reference_filename, int reference_stream,
+                      const char *filename, int stream_index, int64_t *offset)
+{
+    std::vector<float> reference, x;
+    double reference_start, x_start;
+    int lag, ret;
+
+    *offset = 0;
+    if ((ret = decode_window(reference_filename, reference_stream, reference, &reference_start)) < 0) {
+        qDebug() << "Could not decode reference audio of" << reference_filename;
+        return ret;
+    }
+    if ((ret = decode_window(filename, stream_index, x, &x_start)) < 0) {
+        qDebug() << "Could not decode audio of" << filename;
+        return ret;
+    }
+    ret = cross_correlate(reference, x, ALIGN_MAX_LAG_SECONDS * ALIGN_SAMPLE_RATE, &lag);
+    if (ret < 0)
+        return ret;
+
+    // x sample n plays at x_start + n / rate and matches the reference at
+    // reference_start + (n + lag) / rate
+    *offset = (int64_t)((reference_start - x_start + (double)lag / ALIGN_SAMPLE_RATE) * AV_TIME_BASE);
+    return 0;
+}
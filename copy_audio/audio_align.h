@@ -0,0 +1,17 @@
+#ifndef AUDIO_ALIGN_H
+#define AUDIO_ALIGN_H
+
+#include <stdint.h>
+
+/**
+ * Find how far an audio track is offset from a reference recording of the
+ * same scene, by cross-correlating the first seconds of both.
+ *
+ * @param offset set to the amount, in AV_TIME_BASE units, to add to the
+ *               timestamps of stream_index in filename so it lines up with
+ *               reference_stream in reference_filename
+ */
+int find_audio_offset(const char *reference_filename, int reference_stream,
+                      const char *filename, int stream_index, int64_t *offset);
+
+#endif /* AUDIO_ALIGN_H */
@@ -4,7 +4,11 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <queue>
 #include <filesystem>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <opencv2/opencv.hpp>  // For reading images, optional if not using OpenCV
 extern "C" {
     #include <libavformat/avformat.h>
@@ -12,113 +16,341 @@ extern "C" {
     #include <libavutil/imgutils.h>
     #include <libswscale/swscale.h>
 }
+#include "audio_align.h"
 
 namespace fs = std::filesystem;
 
-int main(int argc, char **argv)
-{
-    QCoreApplication app (argc, argv);
-    if (argc < 4)
-    {
-        qDebug() << "usage: " << argv[0] << "<input video without audio stream> <input video with audio> <output video with audio>\n";
-        return 1;
-    }
+/*
+ * One entry of a stream selection spec: a media type (v, a, s or d),
+ * optionally followed by ':' and either the index among the streams of that
+ * type or a language tag, e.g. "v", "a:1", "a:eng". A spec is a comma
+ * separated list of entries, e.g. "a:eng,s:eng".
+ */
+struct StreamSelector {
+    enum AVMediaType type = AVMEDIA_TYPE_UNKNOWN;
+    int index = -1;
+    std::string language;
+    int matched = 0;
+};
 
-    const char *in_filename_target = argv[1];
-    const char *in_filename_source = argv[2];
-    const char *out_filename = argv[3];
-    int ret, i;
-    AVDictionary *opts = NULL;
+struct InputFile {
+    const char *filename = NULL;
+    AVFormatContext *format_context = NULL;
+    std::vector<StreamSelector> selectors;
+    // input stream index -> output stream index, -1 for streams not copied
+    std::vector<int> streams_list;
+    // next packet of this input, already mapped to the output stream and
+    // time base, waiting for its turn in the merge
+    AVPacket *packet = NULL;
+    // added to every timestamp of this input, in AV_TIME_BASE
+    int64_t offset = 0;
+};
 
-    AVFormatContext *input_format_context_target = NULL, *input_format_context_source = NULL, *output_format_context = NULL;
+static int parse_spec(const std::string &spec, std::vector<StreamSelector> &selectors)
+{
+    size_t start = 0;
 
-    if ((ret = avformat_open_input(&input_format_context_target, in_filename_target, NULL, NULL)) < 0)
+    while (start <= spec.size())
     {
-        qDebug() << "Could not open input file " << in_filename_target;
-        return 0;
-    }
-    if ((ret = avformat_find_stream_info(input_format_context_target, NULL)) < 0)
-    {
-        qDebug() << "Failed to retrieve input stream information";
-        return 0;
+        size_t end = spec.find(',', start);
+        std::string entry = spec.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        StreamSelector selector;
+
+        switch (entry.empty() ? 0 : entry[0])
+        {
+        case 'v': selector.type = AVMEDIA_TYPE_VIDEO; break;
+        case 'a': selector.type = AVMEDIA_TYPE_AUDIO; break;
+        case 's': selector.type = AVMEDIA_TYPE_SUBTITLE; break;
+        case 'd': selector.type = AVMEDIA_TYPE_DATA; break;
+        default:
+            qDebug() << "Invalid stream selection" << entry.c_str();
+            return AVERROR(EINVAL);
+        }
+        if (entry.size() > 2 && entry[1] == ':')
+        {
+            std::string qualifier = entry.substr(2);
+            if (qualifier.find_first_not_of("0123456789") == std::string::npos)
+            {
+                long index;
+                errno = 0;
+                index = strtol(qualifier.c_str(), NULL, 10);
+                if (errno == ERANGE || index > INT_MAX)
+                {
+                    qDebug() << "Invalid stream index" << qualifier.c_str();
+                    return AVERROR(EINVAL);
+                }
+                selector.index = (int)index;
+            }
+            else
+                selector.language = qualifier;
+        }
+        else if (entry.size() > 1)
+        {
+            qDebug() << "Invalid stream selection" << entry.c_str();
+            return AVERROR(EINVAL);
+        }
+        selectors.push_back(selector);
+
+        if (end == std::string::npos)
+            break;
+        start = end + 1;
     }
+    return 0;
+}
+
+static int open_input(InputFile &input)
+{
+    int ret;
 
-    if ((ret = avformat_open_input(&input_format_context_source, in_filename_source, NULL, NULL)) < 0)
+    if ((ret = avformat_open_input(&input.format_context, input.filename, NULL, NULL)) < 0)
     {
-        qDebug() << "Could not open input file " << in_filename_source;
-        return 0;
+        qDebug() << "Could not open input file " << input.filename;
+        return ret;
     }
-    if ((ret = avformat_find_stream_info(input_format_context_source, NULL)) < 0)
+    if ((ret = avformat_find_stream_info(input.format_context, NULL)) < 0)
     {
         qDebug() << "Failed to retrieve input stream information";
-        return 0;
+        return ret;
     }
+    input.streams_list.assign(input.format_context->nb_streams, -1);
+    input.packet = av_packet_alloc();
+    if (!input.packet)
+        return AVERROR(ENOMEM);
+    return 0;
+}
 
-    avformat_alloc_output_context2(&output_format_context, NULL, NULL, out_filename);
-    if (!output_format_context)
+static bool select_stream(InputFile &input, const AVStream *in_stream, int index_in_type)
+{
+    const AVDictionaryEntry *language = av_dict_get(in_stream->metadata, "language", NULL, 0);
+    bool selected = false;
+
+    for (auto &selector : input.selectors)
     {
-        qDebug() << "Could not create output context";
-        return 0;
+        if (selector.type != in_stream->codecpar->codec_type)
+            continue;
+        if (selector.index >= 0 && selector.index != index_in_type)
+            continue;
+        if (!selector.language.empty() && (!language || selector.language != language->value))
+            continue;
+        selector.matched = 1;
+        selected = true;
     }
+    return selected;
+}
 
-    int stream_index = 0;
-    int *streams_list = NULL;
-    int number_of_streams = 0;
-
-    number_of_streams = input_format_context_source->nb_streams;
-    streams_list = (int *)av_malloc_array(number_of_streams, sizeof(*streams_list));
-    qDebug() << "number_of_streams" << number_of_streams;
+static int add_streams(InputFile &input, AVFormatContext *output_format_context)
+{
+    int count_per_type[AVMEDIA_TYPE_NB] = { 0 };
+    unsigned int i;
+    int ret;
 
-    for (i = 0; i < input_format_context_target->nb_streams; i++)
+    for (i = 0; i < input.format_context->nb_streams; i++)
     {
         AVStream *out_stream;
-        AVStream *in_stream = input_format_context_target->streams[i];
+        AVStream *in_stream = input.format_context->streams[i];
         AVCodecParameters *in_codecpar = in_stream->codecpar;
-        if (in_codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
+        int index_in_type = in_codecpar->codec_type >= 0 && in_codecpar->codec_type < AVMEDIA_TYPE_NB
+                            ? count_per_type[in_codecpar->codec_type]++ : -1;
+        if (!select_stream(input, in_stream, index_in_type))
         {
             continue;
         }
-        streams_list[i] = stream_index++;
         out_stream = avformat_new_stream(output_format_context, NULL);
         if (!out_stream)
         {
             qDebug() << "Failed allocating output stream";
-            ret = AVERROR_UNKNOWN;
-            goto end;
+            return AVERROR_UNKNOWN;
         }
+        input.streams_list[i] = out_stream->index;
         ret = avcodec_parameters_copy(out_stream->codecpar, in_codecpar);
         if (ret < 0)
         {
             qDebug() << "Failed to copy codec parameters";
-            goto end;
+            return ret;
         }
+        // keep the language tags and default/forced flags players pick tracks by
+        av_dict_copy(&out_stream->metadata, in_stream->metadata, 0);
+        out_stream->disposition = in_stream->disposition;
     }
-
-    for (i = 0; i < input_format_context_source->nb_streams; i++)
+    for (auto &selector : input.selectors)
     {
-        AVStream *out_stream;
-        AVStream *in_stream = input_format_context_source->streams[i];
-        AVCodecParameters *in_codecpar = in_stream->codecpar;
-        if (in_codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+        if (!selector.matched)
         {
-            continue;
+            qDebug() << "No stream of" << input.filename << "matches" << av_get_media_type_string(selector.type)
+                     << selector.index << selector.language.c_str();
+            return AVERROR_STREAM_NOT_FOUND;
         }
-        streams_list[i] = stream_index++;
-        out_stream = avformat_new_stream(output_format_context, NULL);
-        if (!out_stream)
+    }
+    return 0;
+}
+
+/*
+ * Read the next packet of a copied stream into input.packet, with its
+ * stream index and timestamps already in terms of the output.
+ */
+static int read_packet(InputFile &input, AVFormatContext *output_format_context)
+{
+    AVPacket *packet = input.packet;
+    AVStream *in_stream, *out_stream;
+    int ret;
+
+    while ((ret = av_read_frame(input.format_context, packet)) >= 0)
+    {
+        if (packet->stream_index < (int)input.streams_list.size() && input.streams_list[packet->stream_index] >= 0)
+            break;
+        av_packet_unref(packet);
+    }
+    if (ret < 0)
+        return ret;
+
+    in_stream = input.format_context->streams[packet->stream_index];
+    packet->stream_index = input.streams_list[packet->stream_index];
+    out_stream = output_format_context->streams[packet->stream_index];
+    /* copy packet */
+    packet->pts = av_rescale_q_rnd(packet->pts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+    packet->dts = av_rescale_q_rnd(packet->dts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+    packet->duration = av_rescale_q(packet->duration, in_stream->time_base, out_stream->time_base);
+    if (input.offset)
+    {
+        int64_t shift = av_rescale_q(input.offset, AV_TIME_BASE_Q, out_stream->time_base);
+        if (packet->pts != AV_NOPTS_VALUE)
+            packet->pts += shift;
+        if (packet->dts != AV_NOPTS_VALUE)
+            packet->dts += shift;
+    }
+    // https://ffmpeg.org/doxygen/trunk/structAVPacket.html#ab5793d8195cf4789dfb3913b7a693903
+    packet->pos = -1;
+    return 0;
+}
+
+/*
+ * Shift every other input so its audio lines up with the audio of the first
+ * input, which is taken as the reference recording (e.g. the camera's own
+ * track, even if it is not muxed).
+ */
+static int align_inputs(std::vector<InputFile> &inputs)
+{
+    int reference_stream = av_find_best_stream(inputs[0].format_context, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    size_t i, j;
+    int ret;
+
+    if (reference_stream < 0)
+    {
+        qDebug() << inputs[0].filename << "has no audio to align to";
+        return 0;
+    }
+    for (i = 1; i < inputs.size(); i++)
+    {
+        for (j = 0; j < inputs[i].streams_list.size(); j++)
         {
-            qDebug() << "Failed allocating output stream";
-            ret = AVERROR_UNKNOWN;
-            goto end;
+            if (inputs[i].streams_list[j] >= 0 &&
+                inputs[i].format_context->streams[j]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+                break;
         }
-        ret = avcodec_parameters_copy(out_stream->codecpar, in_codecpar);
+        if (j == inputs[i].streams_list.size())
+            continue;
+
+        ret = find_audio_offset(inputs[0].filename, reference_stream, inputs[i].filename, j, &inputs[i].offset);
         if (ret < 0)
+            return ret;
+        qDebug() << inputs[i].filename << "offset" << inputs[i].offset / 1000.0 << "ms";
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app (argc, argv);
+    int align = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-align"))
+    {
+        align = 1;
+        argc--;
+        argv++;
+    }
+    if (argc < 4)
+    {
+        qDebug() << "usage: " << argv[0] << "[-align] <input video without audio stream> <input video with audio> <output video with audio>\n"
+                 << "       " << argv[0] << "[-align] -i <input> <streams> [-i <input> <streams> ...] <output>\n"
+                 << "<streams> is a comma separated list of v, a, s or d, each optionally followed by\n"
+                 << ":<index> or :<language>, e.g. -i video.mp4 v -i dub.mka a:eng -i subs.mkv s:eng\n"
+                 << "-align shifts the audio of every other input to match the audio of the first one\n";
+        return 1;
+    }
+
+    const char *out_filename;
+    int ret = 0;
+    size_t i;
+    AVDictionary *opts = NULL;
+    AVFormatContext *output_format_context = NULL;
+    std::vector<InputFile> inputs;
+
+    if (!strcmp(argv[1], "-i"))
+    {
+        int arg;
+        for (arg = 1; arg + 2 < argc && !strcmp(argv[arg], "-i"); arg += 3)
         {
-            qDebug() << "Failed to copy codec parameters";
-            goto end;
+            InputFile input;
+            input.filename = argv[arg + 1];
+            if (parse_spec(argv[arg + 2], input.selectors) < 0)
+                return 1;
+            inputs.push_back(input);
+        }
+        if (arg != argc - 1)
+        {
+            qDebug() << "Expected '-i <input> <streams>' pairs followed by the output file";
+            return 1;
         }
+        out_filename = argv[arg];
+    }
+    else
+    {
+        // video from the first file, audio from the second
+        inputs.resize(2);
+        inputs[0].filename = argv[1];
+        parse_spec("v", inputs[0].selectors);
+        inputs[1].filename = argv[2];
+        parse_spec("a", inputs[1].selectors);
+        out_filename = argv[3];
     }
 
+    // the next packet of every input, earliest dts on top; each input has at
+    // most one packet waiting, so memory does not grow with the file length
+    auto later = [&](size_t a, size_t b) {
+        const AVPacket *pa = inputs[a].packet, *pb = inputs[b].packet;
+        int64_t ta = pa->dts != AV_NOPTS_VALUE ? pa->dts : pa->pts;
+        int64_t tb = pb->dts != AV_NOPTS_VALUE ? pb->dts : pb->pts;
+        if (ta == AV_NOPTS_VALUE || tb == AV_NOPTS_VALUE)
+            return tb == AV_NOPTS_VALUE && ta != AV_NOPTS_VALUE;
+        return av_compare_ts(ta, output_format_context->streams[pa->stream_index]->time_base,
+                             tb, output_format_context->streams[pb->stream_index]->time_base) > 0;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> pending(later);
+
+    for (i = 0; i < inputs.size(); i++)
+    {
+        if ((ret = open_input(inputs[i])) < 0)
+            goto end;
+    }
+
+    avformat_alloc_output_context2(&output_format_context, NULL, NULL, out_filename);
+    if (!output_format_context)
+    {
+        qDebug() << "Could not create output context";
+        ret = AVERROR_UNKNOWN;
+        goto end;
+    }
+
+    for (i = 0; i < inputs.size(); i++)
+    {
+        if ((ret = add_streams(inputs[i], output_format_context)) < 0)
+            goto end;
+    }
+
+    if (align && (ret = align_inputs(inputs)) < 0)
+        goto end;
+
     av_dump_format(output_format_context, 0, out_filename, 1);
 
     if (!(output_format_context->oformat->flags & AVFMT_NOFILE))
@@ -139,81 +371,48 @@ int main(int argc, char **argv)
         goto end;
     }
 
-    AVPacket packet;
-    while (1)
+    // k-way merge of the demuxers by dts: always write the earliest pending
+    // packet, then refill from the input it came from
+    for (i = 0; i < inputs.size(); i++)
     {
-        AVStream *in_stream, *out_stream;
-        ret = av_read_frame(input_format_context_target, &packet);
-        if (ret < 0)
-            break;
-        in_stream = input_format_context_target->streams[packet.stream_index];
-        if (packet.stream_index >= number_of_streams || streams_list[packet.stream_index] < 0)
-        {
-            av_packet_unref(&packet);
-            continue;
-        }
-        packet.stream_index = streams_list[packet.stream_index];
-        out_stream = output_format_context->streams[packet.stream_index];
-        /* copy packet */
-        packet.pts = av_rescale_q_rnd(packet.pts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        packet.dts = av_rescale_q_rnd(packet.dts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        packet.duration = av_rescale_q(packet.duration, in_stream->time_base, out_stream->time_base);
-        // https://ffmpeg.org/doxygen/trunk/structAVPacket.html#ab5793d8195cf4789dfb3913b7a693903
-        packet.pos = -1;
+        ret = read_packet(inputs[i], output_format_context);
+        if (ret >= 0)
+            pending.push(i);
+        else if (ret != AVERROR_EOF)
+            goto end;
+    }
+    while (!pending.empty())
+    {
+        size_t next = pending.top();
+        pending.pop();
 
         // https://ffmpeg.org/doxygen/trunk/group__lavf__encoding.html#ga37352ed2c63493c38219d935e71db6c1
-        ret = av_interleaved_write_frame(output_format_context, &packet);
+        ret = av_interleaved_write_frame(output_format_context, inputs[next].packet);
         if (ret < 0)
         {
             fprintf(stderr, "Error muxing packet\n");
-            break;
+            goto end;
         }
-        av_packet_unref(&packet);
-    }
 
-    while (1)
-    {
-        AVStream *in_stream, *out_stream;
-        ret = av_read_frame(input_format_context_source, &packet);
-        if (ret < 0)
-            break;
-        in_stream = input_format_context_source->streams[packet.stream_index];
-        AVCodecParameters *in_codecpar = in_stream->codecpar;
-        if (in_codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
-        {
-            continue;
-        }
-        if (packet.stream_index >= number_of_streams || streams_list[packet.stream_index] < 0)
-        {
-            av_packet_unref(&packet);
-            continue;
-        }
-        packet.stream_index = streams_list[packet.stream_index];
-        out_stream = output_format_context->streams[1];
-        /* copy packet */
-        packet.pts = av_rescale_q_rnd(packet.pts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        packet.dts = av_rescale_q_rnd(packet.dts, in_stream->time_base, out_stream->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        packet.duration = av_rescale_q(packet.duration, in_stream->time_base, out_stream->time_base);
-        packet.pos = -1;
-
-        ret = av_interleaved_write_frame(output_format_context, &packet);
-        if (ret < 0)
-        {
-            fprintf(stderr, "Error muxing packet\n");
-            break;
-        }
-        av_packet_unref(&packet);
+        ret = read_packet(inputs[next], output_format_context);
+        if (ret >= 0)
+            pending.push(next);
+        else if (ret != AVERROR_EOF)
+            goto end;
     }
+    ret = 0;
 
     av_write_trailer(output_format_context);
 
 end:
-    avformat_close_input(&input_format_context_target);
-    avformat_close_input(&input_format_context_source);
+    for (i = 0; i < inputs.size(); i++)
+    {
+        avformat_close_input(&inputs[i].format_context);
+        av_packet_free(&inputs[i].packet);
+    }
     if (output_format_context && !(output_format_context->oformat->flags & AVFMT_NOFILE))
         avio_closep(&output_format_context->pb);
     avformat_free_context(output_format_context);
-    av_freep(&streams_list);
     if (ret < 0 && ret != AVERROR_EOF)
     {
         qDebug() << "Error occurred: " << av_err2str(ret);
@@ -221,4 +420,4 @@ end:
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,219 @@
+#include "archive.h"
+
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <zlib.h>
+extern "C"
+{
+    #include <libavutil/error.h>
+    #include <libavutil/file.h>
+    #include <libavutil/intreadwrite.h>
+    #include <libavutil/log.h>
+}
+
+#define TAR_BLOCK 512
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZIP_CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define ZIP_END_SIGNATURE 0x06054b50
+#define ZIP_END_SIZE 22
+
+ImageArchive::~ImageArchive()
+{
+    if (buffer_)
+        av_file_unmap(buffer_, size_);
+}
+
+bool ImageArchive::is_archive(const char *filename)
+{
+    const char *extension = strrchr(filename, '.');
+    return extension && (!strcasecmp(extension, ".tar") || !strcasecmp(extension, ".zip"));
+}
+
+int ImageArchive::open(const char *filename)
+{
+    int ret = av_file_map(filename, &buffer_, &size_, 0, NULL);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not map %s\n", filename);
+        return ret;
+    }
+
+    if (size_ >= 4 && AV_RL32(buffer_) == ZIP_LOCAL_HEADER_SIGNATURE)
+        ret = index_zip();
+    else if (size_ >= TAR_BLOCK && !memcmp(buffer_ + 257, "ustar", 5))
+        ret = index_tar();
+    else
+        ret = AVERROR_INVALIDDATA;
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s is not a supported tar or zip archive\n", filename);
+        return ret;
+    }
+
+    std::sort(members_.begin(), members_.end(),
+              [](const Member &a, const Member &b) { return a.name < b.name; });
+    return 0;
+}
+
+static uint64_t tar_number(const uint8_t *field, int length)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+        value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+static std::string tar_string(const uint8_t *field, int length)
+{
+    return std::string((const char *)field, strnlen((const char *)field, length));
+}
+
+/* The path record of a pax extended header, "<len> path=<name>\n". */
+static std::string pax_path(const uint8_t *data, uint64_t size)
+{
+    uint64_t pos = 0;
+    while (pos < size) {
+        uint64_t len = 0, start = pos;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9')
+            len = len * 10 + (data[pos++] - '0');
+        if (!len || start + len > size)
+            break;
+        std::string record((const char *)data + pos, start + len - pos);
+        if (record.compare(0, 6, " path=") == 0 && record.back() == '\n')
+            return record.substr(6, record.size() - 7);
+        pos = start + len;
+    }
+    return std::string();
+}
+
+int ImageArchive::index_tar()
+{
+    uint64_t pos = 0;
+    std::string long_name;
+
+    while (pos + TAR_BLOCK <= size_) {
+        const uint8_t *header = buffer_ + pos;
+        if (!header[0])
+            break; // end of archive blocks
+        uint64_t size = tar_number(header + 124, 12);
+        char type = header[156];
+        uint64_t data = pos + TAR_BLOCK;
+        if (data + size > size_)
+            return AVERROR_INVALIDDATA;
+
+        if (type == 'L' || type == 'x') {
+            // the name of the next member, GNU and pax style
+            long_name = type == 'L' ? tar_string(buffer_ + data, size) : pax_path(buffer_ + data, size);
+        } else {
+            if (type == '0' || type == '\0') {
+                Member member;
+                if (!long_name.empty()) {
+                    member.name = long_name;
+                } else {
+                    std::string prefix = tar_string(header + 345, 155);
+                    member.name = tar_string(header, 100);
+                    if (!prefix.empty())
+                        member.name = prefix + "/" + member.name;
+                }
+                member.offset = data;
+                member.size = member.uncompressed_size = size;
+                member.method = 0;
+                members_.push_back(member);
+            }
+            long_name.clear();
+        }
+        pos = data + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+    return 0;
+}
+
+int ImageArchive::index_zip()
+{
+    const uint8_t *end = NULL;
+    uint64_t pos, count;
+
+    // the end of central directory record is last, before a comment of up to 64 KiB
+    for (int64_t i = (int64_t)size_ - ZIP_END_SIZE; i >= 0 && i >= (int64_t)size_ - ZIP_END_SIZE - 65535; i--) {
+        if (AV_RL32(buffer_ + i) == ZIP_END_SIGNATURE) {
+            end = buffer_ + i;
+            break;
+        }
+    }
+    if (!end)
+        return AVERROR_INVALIDDATA;
+    count = AV_RL16(end + 10);
+    pos = AV_RL32(end + 16);
+    if (count == 0xffff || pos == 0xffffffff) {
+        av_log(NULL, AV_LOG_ERROR, "Zip64 archives are not supported\n");
+        return AVERROR_PATCHWELCOME;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (pos + 46 > size_ || AV_RL32(buffer_ + pos) != ZIP_CENTRAL_HEADER_SIGNATURE)
+            return AVERROR_INVALIDDATA;
+        const uint8_t *header = buffer_ + pos;
+        int name_length = AV_RL16(header + 28);
+        int extra_length = AV_RL16(header + 30);
+        int comment_length = AV_RL16(header + 32);
+        uint64_t local = AV_RL32(header + 42);
+        if (pos + 46 + name_length > size_)
+            return AVERROR_INVALIDDATA;
+
+        Member member;
+        member.name.assign((const char *)header + 46, name_length);
+        member.method = AV_RL16(header + 10);
+        member.size = AV_RL32(header + 20);
+        member.uncompressed_size = AV_RL32(header + 24);
+        pos += 46 + name_length + extra_length + comment_length;
+
+        // sizes come from the central directory, the local header may defer
+        // them to a data descriptor; its name and extra field lengths can
+        // differ from the central ones
+        if (local + 30 > size_ || AV_RL32(buffer_ + local) != ZIP_LOCAL_HEADER_SIGNATURE)
+            return AVERROR_INVALIDDATA;
+        member.offset = local + 30 + AV_RL16(buffer_ + local + 26) + AV_RL16(buffer_ + local + 28);
+        if (member.offset + member.size > size_)
+            return AVERROR_INVALIDDATA;
+
+        if (member.name.empty() || member.name.back() == '/')
+            continue; // directory
+        if (member.method != 0 && member.method != 8) {
+            av_log(NULL, AV_LOG_WARNING, "Skipping %s, compression method %d is not supported\n",
+                   member.name.c_str(), member.method);
+            continue;
+        }
+        members_.push_back(member);
+    }
+    return 0;
+}
+
+int ImageArchive::read(size_t i, std::vector<uint8_t> &buffer, const uint8_t **data, size_t *size) const
+{
+    const Member &member = members_[i];
+    z_stream stream;
+    int ret;
+
+    if (member.method == 0) {
+        *data = buffer_ + member.offset;
+        *size = member.size;
+        return 0;
+    }
+
+    // raw deflate, no zlib header
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return AVERROR(ENOMEM);
+    buffer.resize(member.uncompressed_size);
+    stream.next_in = (Bytef *)(buffer_ + member.offset);
+    stream.avail_in = member.size;
+    stream.next_out = buffer.data();
+    stream.avail_out = buffer.size();
+    ret = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (ret != Z_STREAM_END) {
+        av_log(NULL, AV_LOG_ERROR, "Could not inflate %s\n", member.name.c_str());
+        return AVERROR_INVALIDDATA;
+    }
+    *data = buffer.data();
+    *size = buffer.size();
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Read-only view of the files in a tar or zip archive. The archive is
+ * mapped once and its member list indexed up front; stored members are then
+ * returned as pointers into the mapping, deflated zip members are inflated
+ * into a caller buffer. Nothing is extracted to disk.
+ *
+ * Supported: ustar/GNU tar (with GNU long names and pax path records) and
+ * zip with stored or deflated members. Zip64 archives are not.
+ */
+class ImageArchive {
+public:
+    struct Member {
+        std::string name;
+        uint64_t offset; ///< of the data in the archive
+        uint64_t size; ///< stored size
+        uint64_t uncompressed_size;
+        int method; ///< 0 stored, 8 deflate
+    };
+
+    ImageArchive() = default;
+    ~ImageArchive();
+
+    ImageArchive(const ImageArchive &) = delete;
+    ImageArchive &operator=(const ImageArchive &) = delete;
+
+    /** true if filename looks like an archive this class can read */
+    static bool is_archive(const char *filename);
+
+    /** Map the archive and index its regular files, sorted by name. */
+    int open(const char *filename);
+
+    const std::vector<Member> &members() const { return members_; }
+
+    /**
+     * Point data and size at the contents of member i, using buffer for
+     * compressed members. Safe to call from several threads with their own
+     * buffers.
+     */
+    int read(size_t i, std::vector<uint8_t> &buffer, const uint8_t **data, size_t *size) const;
+
+private:
+    int index_tar();
+    int index_zip();
+
+    uint8_t *buffer_ = NULL; ///< mapped archive
+    size_t size_ = 0;
+    std::vector<Member> members_;
+};
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,83 @@
+#include "duplicates.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+#include <stdlib.h>
+extern "C"
+{
+    #include <libavutil/buffer.h>
+    #include <libavutil/cpu.h>
+    #include <libavutil/error.h>
+}
+
+int still_attach_thumbnail(AVFrame *frame)
+{
+    AVBufferRef *thumb = av_buffer_alloc(STILL_THUMB_SIZE);
+    if (!thumb)
+        return AVERROR(ENOMEM);
+
+    for (int ty = 0; ty < STILL_THUMB_HEIGHT; ty++) {
+        int y0 = ty * frame->height / STILL_THUMB_HEIGHT;
+        int y1 = (ty + 1) * frame->height / STILL_THUMB_HEIGHT;
+        for (int tx = 0; tx < STILL_THUMB_WIDTH; tx++) {
+            int x0 = tx * frame->width / STILL_THUMB_WIDTH;
+            int x1 = (tx + 1) * frame->width / STILL_THUMB_WIDTH;
+            unsigned sum = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t *row = frame->data[0] + y * frame->linesize[0];
+                for (int x = x0; x < x1; x++)
+                    sum += row[x];
+            }
+            int area = (y1 - y0) * (x1 - x0);
+            thumb->data[ty * STILL_THUMB_WIDTH + tx] = area ? sum / area : 0;
+        }
+    }
+
+    av_buffer_unref(&frame->opaque_ref);
+    frame->opaque_ref = thumb;
+    return 0;
+}
+
+static uint64_t sad_c(const uint8_t *a, const uint8_t *b, int size)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < size; i++)
+        sum += abs(a[i] - b[i]);
+    return sum;
+}
+
+#if HAVE_X86
+/* 32 bytes per _mm256_sad_epu8, which sums absolute differences into 4 u64 lanes. */
+__attribute__((target("avx2")))
+static uint64_t sad_avx2(const uint8_t *a, const uint8_t *b, int size)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+
+    for (; i + 32 <= size; i += 32)
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                    _mm256_loadu_si256((const __m256i *)(b + i))));
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (uint64_t)_mm_cvtsi128_si64(sum) + sad_c(a + i, b + i, size - i);
+}
+#endif
+
+double still_difference(const AVFrame *a, const AVFrame *b)
+{
+    uint64_t sad;
+
+    if (!a->opaque_ref || !b->opaque_ref)
+        return -1;
+#if HAVE_X86
+    if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+        sad = sad_avx2(a->opaque_ref->data, b->opaque_ref->data, STILL_THUMB_SIZE);
+    else
+#endif
+        sad = sad_c(a->opaque_ref->data, b->opaque_ref->data, STILL_THUMB_SIZE);
+    return (double)sad / STILL_THUMB_SIZE;
+}
@@ -0,0 +1,32 @@
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#include <stdint.h>
+extern "C"
+{
+    #include <libavutil/frame.h>
+}
+
+/**
+ * Near-duplicate still detection. Every frame gets a small luma thumbnail,
+ * block averages of its Y plane, and two frames count as the same picture
+ * when the mean absolute difference of their thumbnails is under a threshold
+ * (0-255 scale). Averaging first makes it insensitive to sensor noise and
+ * JPEG artifacts, and keeps the comparison to a few SAD instructions.
+ */
+#define STILL_THUMB_WIDTH 64
+#define STILL_THUMB_HEIGHT 36
+#define STILL_THUMB_SIZE (STILL_THUMB_WIDTH * STILL_THUMB_HEIGHT)
+
+/**
+ * Compute the thumbnail of a YUV frame and attach it as frame->opaque_ref.
+ */
+int still_attach_thumbnail(AVFrame *frame);
+
+/**
+ * Mean absolute difference of the thumbnails of two frames, or a negative
+ * value if one has none.
+ */
+double still_difference(const AVFrame *a, const AVFrame *b);
+
+#endif /* DUPLICATES_H */
@@ -1,10 +1,18 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QDebug>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <map>
+#include <set>
+#include <thread>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 #include <opencv2/opencv.hpp>  // For reading images, optional if not using OpenCV
 extern "C" {
     #include <libavformat/avformat.h>
@@ -12,10 +20,223 @@ extern "C" {
     #include <libavutil/imgutils.h>
     #include <libswscale/swscale.h>
 }
+#include "archive.h"
+#include "duplicates.h"
+#include "prefetch.h"
 
 namespace fs = std::filesystem;
 
-void encode_images_to_video(const std::string& folder_path, const char* output_file, int width, int height, int fps) {
+// images decoded ahead of the encoder, per worker thread
+#define PREFETCH_PER_THREAD 4
+
+struct EncodeOptions {
+    bool watch = false; ///< keep encoding images as they arrive in the folder
+    double dedupe_threshold = -1; ///< mean luma difference under which stills are merged, negative to keep all
+};
+
+struct PrepareContext {
+    std::mutex files_mutex; ///< the watcher appends while workers read
+    std::vector<fs::path> files;
+    const ImageArchive *archive; ///< files are members of this archive, or NULL for a folder
+    std::vector<std::vector<uint8_t>> inflate_buffers; ///< per prefetch worker
+    int width, height;
+    bool dedupe; ///< attach duplicate detection thumbnails to the frames
+    /// per prefetch worker, one context per source resolution
+    std::vector<std::map<std::pair<int, int>, SwsContext *>> sws_ctx;
+};
+
+/*
+ * Scaling to the output size and BGR to YUV420P conversion happen in the same
+ * sws_scale() pass; stills of a sequence usually share a few resolutions, so
+ * their contexts are kept instead of rebuilt when sizes alternate.
+ */
+static SwsContext *get_sws_context(PrepareContext *pc, int worker, int src_width, int src_height)
+{
+    SwsContext *&sws_ctx = pc->sws_ctx[worker][std::make_pair(src_width, src_height)];
+    if (!sws_ctx) {
+        sws_ctx = sws_getContext(
+            src_width, src_height, AV_PIX_FMT_BGR24,  // Input dimensions and format
+            pc->width, pc->height, AV_PIX_FMT_YUV420P, // Output dimensions and format
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!sws_ctx)
+            qDebug() << "Could not initialize the sws context for" << src_width << "x" << src_height;
+    }
+    return sws_ctx;
+}
+
+/*
+ * Runs on a prefetch worker: decode one image and convert it into a new
+ * YUV420P frame the encoder can take as is.
+ */
+static AVFrame *prepare_image(PrepareContext *pc, size_t item, int worker)
+{
+    fs::path filename;
+    {
+        std::lock_guard<std::mutex> lock(pc->files_mutex);
+        filename = pc->files[item];
+    }
+
+    // Load the image using OpenCV, archive members straight from the mapping
+    cv::Mat img;
+    if (pc->archive) {
+        const uint8_t *data;
+        size_t size;
+        if (pc->archive->read(item, pc->inflate_buffers[worker], &data, &size) >= 0)
+            img = cv::imdecode(cv::Mat(1, (int)size, CV_8UC1, (void *)data), cv::IMREAD_COLOR);
+    } else {
+        img = cv::imread(filename.c_str());
+    }
+    if (img.empty()) {
+        qDebug() << "Could not read image: " << filename.c_str();
+        return nullptr;
+    }
+
+    SwsContext* sws_ctx = get_sws_context(pc, worker, img.cols, img.rows);
+    if (!sws_ctx)
+        return nullptr;
+
+    AVFrame* frame = av_frame_alloc();
+    if (!frame)
+        return nullptr;
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = pc->width;
+    frame->height = pc->height;
+    if (av_frame_get_buffer(frame, 32) < 0) {
+        qDebug() << "Could not allocate frame buffer";
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    // Resize and convert the image to YUV420P format
+    uint8_t* in_data[1] = { img.data };
+    int in_linesize[1] = { static_cast<int>(img.step) };
+    sws_scale(sws_ctx, in_data, in_linesize, 0, img.rows, frame->data, frame->linesize);
+    if (pc->dedupe && still_attach_thumbnail(frame) < 0)
+        av_frame_free(&frame);
+    return frame;
+}
+
+/*
+ * Send one frame and write whatever packets the encoder has ready. Returns a
+ * negative value only if encoding failed for good.
+ */
+static int encode_frame(AVCodecContext* codec_ctx, AVFrame* frame, AVPacket* packet,
+                        AVFormatContext* format_ctx, AVStream* stream)
+{
+    int ret = avcodec_send_frame(codec_ctx, frame);
+    if (ret < 0) {
+        qDebug() << "Error sending frame";
+        return 0;
+    }
+
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(codec_ctx, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            continue;
+        }
+        else if (ret < 0) {
+            qDebug() << "Error during encoding";
+            return ret;
+        }
+        packet->stream_index = stream->index;
+        av_packet_rescale_ts(packet, codec_ctx->time_base, stream->time_base);
+        av_interleaved_write_frame(format_ctx, packet);
+        av_packet_unref(packet);
+    }
+    return 0;
+}
+
+/* Size and modification time of an image when the folder was listed. */
+struct ScannedFile {
+    uintmax_t size;
+    fs::file_time_type mtime;
+
+    bool operator==(const ScannedFile &other) const { return size == other.size && mtime == other.mtime; }
+};
+
+static ScannedFile scan_file(const fs::path &path)
+{
+    std::error_code error;
+    ScannedFile file;
+    file.size = fs::file_size(path, error);
+    if (error)
+        file.size = UINTMAX_MAX;
+    file.mtime = fs::last_write_time(path, error);
+    return file;
+}
+
+static volatile sig_atomic_t stop_watching = 0;
+
+static void handle_stop_signal(int)
+{
+    stop_watching = 1;
+}
+
+/*
+ * Watch mode: append images closed after writing or moved into the folder to
+ * the prefetch queue until SIGINT/SIGTERM, then let the encoder drain. Images
+ * in scanned were already queued by the initial listing; an event for one is
+ * only its completion being reported late, unless the file changed since,
+ * which means the listing caught it while it was still being written.
+ */
+static void watch_folder(int inotify_fd, const std::string& folder_path, std::map<fs::path, ScannedFile> scanned,
+                         PrepareContext *pc, FramePrefetcher *prefetcher)
+{
+    alignas(struct inotify_event) char buffer[16384];
+    struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+
+    while (!stop_watching) {
+        // wake up regularly to notice the stop signal
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0)
+            continue;
+
+        // files completed in one batch of events are added in name order
+        std::set<fs::path> arrived;
+        for (char *p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (!event->len || (event->mask & IN_ISDIR))
+                continue;
+            fs::path path = fs::path(folder_path) / event->name;
+            auto it = scanned.find(path);
+            if (it != scanned.end()) {
+                bool unchanged = scan_file(path) == it->second;
+                // later events for this name are new images
+                scanned.erase(it);
+                if (unchanged)
+                    continue;
+            }
+            arrived.insert(path);
+        }
+        if (arrived.empty())
+            continue;
+
+        size_t count;
+        {
+            std::lock_guard<std::mutex> lock(pc->files_mutex);
+            pc->files.insert(pc->files.end(), arrived.begin(), arrived.end());
+            count = pc->files.size();
+        }
+        qDebug() << "queued" << arrived.size() << "new images," << count << "total";
+        prefetcher->add(count);
+    }
+    prefetcher->finish();
+}
+
+void encode_images_to_video(const std::string& folder_path, const char* output_file, int width, int height, int fps,
+                            const EncodeOptions& options) {
+
+    // a tar or zip of images is read in place, without extracting it
+    ImageArchive archive;
+    bool from_archive = ImageArchive::is_archive(folder_path.c_str());
+    if (from_archive && archive.open(folder_path.c_str()) < 0)
+        return;
+    if (from_archive && options.watch) {
+        qDebug() << "An archive can't be watched";
+        return;
+    }
 
     // Create the output format context
     AVFormatContext* format_ctx = nullptr;
@@ -60,6 +281,10 @@ void encode_images_to_video(const std::string& folder_path, const char* output_f
     codec_ctx->time_base = (AVRational){1, fps * frame_duration};
     codec_ctx->framerate = (AVRational){fps, 1};
     // codec_ctx->gop_size = 10; // Group of pictures size
+    if (options.watch) {
+        // a keyframe, and so a new fragment, every 2 seconds
+        codec_ctx->gop_size = fps * 2;
+    }
     // codec_ctx->max_b_frames = 1;
     codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
 
@@ -87,85 +312,131 @@ void encode_images_to_video(const std::string& folder_path, const char* output_f
     }
 
     // Write the file header
-    if (avformat_write_header(format_ctx, nullptr) < 0) {
-        qDebug() << "Error writing header";
-        return;
+    AVDictionary* mux_opts = nullptr;
+    if (options.watch) {
+        // fragmented MP4: an empty moov up front and a moof per keyframe, so
+        // the file is playable while it grows and nothing has to be
+        // rewritten at the end
+        av_dict_set(&mux_opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+        format_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
     }
-
-    // Prepare the scaling context
-    SwsContext* sws_ctx = sws_getContext(
-        width, height, AV_PIX_FMT_BGR24,  // Input dimensions and format
-        width, height, AV_PIX_FMT_YUV420P, // Output dimensions and format
-        SWS_BILINEAR, nullptr, nullptr, nullptr);
-
-    if (!sws_ctx) {
-        qDebug() << "Could not initialize the sws context";
+    if (avformat_write_header(format_ctx, &mux_opts) < 0) {
+        qDebug() << "Error writing header";
+        av_dict_free(&mux_opts);
         return;
     }
+    av_dict_free(&mux_opts);
 
-    // Allocate video frame
-    AVFrame* frame = av_frame_alloc();
-    frame->format = AV_PIX_FMT_YUV420P;
-    frame->width = width;
-    frame->height = height;
-    frame->time_base = codec_ctx->time_base;
-    frame->duration = frame_duration;
-    frame->key_frame = 0;
-
-    if (av_frame_get_buffer(frame, 32) < 0) {
-        qDebug() << "Could not allocate frame buffer";
-        return;
+    // watch before listing the folder so no image falls between the two
+    int inotify_fd = -1;
+    if (options.watch) {
+        inotify_fd = inotify_init1(IN_CLOEXEC);
+        if (inotify_fd < 0 || inotify_add_watch(inotify_fd, folder_path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            qDebug() << "Could not watch" << folder_path.c_str();
+            return;
+        }
+        signal(SIGINT, handle_stop_signal);
+        signal(SIGTERM, handle_stop_signal);
     }
 
     // Read images from the folder and encode them
     int pts = 0;
     std::set<fs::path> sorted_by_name;
-    for (auto &entry : fs::directory_iterator(folder_path)) {
-        if (!entry.is_regular_file()) continue;
-        sorted_by_name.insert(entry.path());
-    }
-
-    for (auto &filename : sorted_by_name) {
-        // Load the image using OpenCV
-        cv::Mat img = cv::imread(filename.c_str());
-        if (img.empty()) {
-            qDebug() << "Could not read image: " << filename.c_str();
-            continue;
+    std::map<fs::path, ScannedFile> scanned;
+    if (!from_archive) {
+        for (auto &entry : fs::directory_iterator(folder_path)) {
+            if (!entry.is_regular_file()) continue;
+            sorted_by_name.insert(entry.path());
+            if (options.watch)
+                scanned[entry.path()] = scan_file(entry.path());
         }
+    }
 
-        // Resize the image
-        cv::resize(img, img, cv::Size(width, height));
-
-        // Convert the image to YUV420P format
-        uint8_t* in_data[1] = { img.data };
-        int in_linesize[1] = { static_cast<int>(img.step) };
-        // qDebug() << "img.step: " << img.step << "in_linesize: " << in_linesize[0] << "height: " << height << "frame linesize: " << frame->linesize[0];
-        sws_scale(sws_ctx, in_data, in_linesize, 0, height, frame->data, frame->linesize);
+    // scaling contexts are created as source sizes show up, per thread since
+    // swscale contexts can't be shared across threads
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    PrepareContext pc;
+    if (from_archive) {
+        // members are already sorted by name, keep their indexes
+        for (auto &member : archive.members())
+            pc.files.push_back(member.name);
+        pc.archive = &archive;
+    } else {
+        pc.files.assign(sorted_by_name.begin(), sorted_by_name.end());
+        pc.archive = nullptr;
+    }
+    pc.inflate_buffers.resize(threads);
+    pc.width = width;
+    pc.height = height;
+    pc.dedupe = options.dedupe_threshold >= 0;
+    pc.sws_ctx.resize(threads);
 
-        frame->pts = pts;
-        int ret = avcodec_send_frame(codec_ctx, frame);
-        if (ret < 0) {
-            qDebug() << "Error sending frame";
-            continue;
+    // decode and convert the images on a pool of workers, the encoder gets
+    // them back in file order
+    {
+        FramePrefetcher prefetcher(threads, threads * PREFETCH_PER_THREAD,
+                                   [&pc](size_t item, int worker) { return prepare_image(&pc, item, worker); });
+        prefetcher.add(pc.files.size());
+        std::thread watcher;
+        if (options.watch) {
+            qDebug() << "watching" << folder_path.c_str() << ", stop with Ctrl+C";
+            watcher = std::thread(watch_folder, inotify_fd, folder_path, scanned, &pc, &prefetcher);
+        } else {
+            prefetcher.finish();
         }
 
-        pts += frame_duration;
+        AVFrame* frame;
+        // with duplicate elimination the last picture is held back, repeats
+        // of it only make it last longer; the encoder gets a variable frame
+        // rate with the same timeline
+        AVFrame* pending = nullptr;
+        int64_t duplicates = 0;
+        bool failed = false;
+        while (!failed && prefetcher.next(&frame)) {
+            if (!frame)
+                continue;
 
-        while (ret >= 0) {
-            ret = avcodec_receive_packet(codec_ctx, packet);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            frame->pts = pts;
+            frame->time_base = codec_ctx->time_base;
+            frame->duration = frame_duration;
+            pts += frame_duration;
+
+            if (!pc.dedupe) {
+                failed = encode_frame(codec_ctx, frame, packet, format_ctx, stream) < 0;
+                av_frame_free(&frame);
                 continue;
             }
-            else if (ret < 0) {
-                qDebug() << "Error during encoding";
-                return;
+            if (pending) {
+                // compared to the first still of a run, so slow changes
+                // can't creep through one small step at a time
+                double difference = still_difference(pending, frame);
+                if (difference >= 0 && difference <= options.dedupe_threshold) {
+                    pending->duration += frame->duration;
+                    av_frame_free(&frame);
+                    duplicates++;
+                    continue;
+                }
+                failed = encode_frame(codec_ctx, pending, packet, format_ctx, stream) < 0;
+                av_frame_free(&pending);
             }
-            packet->stream_index = stream->index;
-            av_packet_rescale_ts(packet, codec_ctx->time_base, stream->time_base);
-            av_interleaved_write_frame(format_ctx, packet);
-            av_packet_unref(packet);
+            pending = frame;
+        }
+        if (pending) {
+            if (!failed)
+                failed = encode_frame(codec_ctx, pending, packet, format_ctx, stream) < 0;
+            av_frame_free(&pending);
+        }
+        if (pc.dedupe)
+            qDebug() << duplicates << "duplicate stills merged into the previous frame";
+        if (watcher.joinable()) {
+            stop_watching = 1;
+            watcher.join();
         }
+        if (failed)
+            return;
     }
+    if (inotify_fd >= 0)
+        close(inotify_fd);
 
     // Flush the encoder
     avcodec_send_frame(codec_ctx, nullptr);
@@ -178,8 +449,9 @@ void encode_images_to_video(const std::string& folder_path, const char* output_f
 
     // Write trailer and cleanup
     av_write_trailer(format_ctx);
-    sws_freeContext(sws_ctx);
-    av_frame_free(&frame);
+    for (auto &contexts : pc.sws_ctx)
+        for (auto &sws_ctx : contexts)
+            sws_freeContext(sws_ctx.second);
     av_packet_free(&packet);
     avcodec_free_context(&codec_ctx);
     if (!(format_ctx->oformat->flags & AVFMT_NOFILE)) {
@@ -193,17 +465,40 @@ void encode_images_to_video(const std::string& folder_path, const char* output_f
 int main(int argc, char **argv)
 {
     QCoreApplication app (argc, argv);
-    if (argc < 3)
-    {
-        qDebug() << "usage: " << argv[0] << "<input image folder> <output video file>\n";
-        return 1;
-    }
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Encode the images of a folder, in name order, to a video.");
+    EncodeOptions options;
+
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Input image folder, or .tar or .zip archive of images.");
+    parser.addPositionalArgument("output", "Output video file.");
+    QCommandLineOption watchOption("watch", "Keep running and encode images as they arrive in the folder, writing\n"
+                                            "fragmented MP4 so the output plays while it grows. Stop with Ctrl+C.");
+    parser.addOption(watchOption);
+    QCommandLineOption dedupeOption("dedupe", "Merge consecutive near identical stills into one longer frame.");
+    parser.addOption(dedupeOption);
+    QCommandLineOption thresholdOption("dedupe-threshold", "Mean luma difference (0-255) under which stills count as\n"
+                                                           "identical, 2 by default.", "difference");
+    parser.addOption(thresholdOption);
+    parser.process(app);
 
     int width = 1280;
     int height = 720;
     int fps = 30;
 
-    encode_images_to_video(argv[1], argv[2], width, height, fps);
+    const QStringList args = parser.positionalArguments();
+    if (args.size() < 2)
+    {
+        qDebug() << "usage: " << argv[0] << "[--watch] [--dedupe] <input image folder or archive> <output video file>\n";
+        return 1;
+    }
+    options.watch = parser.isSet(watchOption);
+    if (parser.isSet(dedupeOption) || parser.isSet(thresholdOption))
+        options.dedupe_threshold = parser.isSet(thresholdOption) ? parser.value(thresholdOption).toDouble() : 2.0;
+
+    const QByteArray folder_path = args.at(0).toLocal8Bit();
+    const QByteArray output_file = args.at(1).toLocal8Bit();
+    encode_images_to_video(folder_path.constData(), output_file.constData(), width, height, fps, options);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+extern "C"
+{
+    #include <libavutil/frame.h>
+}
+
+/**
+ * Prepares frames ahead of the encoder on a pool of workers, and hands them
+ * back strictly in item order.
+ *
+ * Workers take the next item number and call prepare(item, worker) for it;
+ * worker is 0..threads-1 so callers can keep per-thread state such as a
+ * SwsContext. Finished frames wait in a reorder buffer until next() reaches
+ * them. At most window items past the one next() waits for are in flight, so
+ * a slow item only stalls the pool once the window is full and memory stays
+ * bounded.
+ *
+ * Items can be added while running with add(); finish() tells next() that no
+ * more will come.
+ */
+class FramePrefetcher {
+public:
+    /** Return the prepared frame, or NULL to skip the item. */
+    typedef std::function<AVFrame *(size_t item, int worker)> PrepareFunction;
+
+    FramePrefetcher(int threads, size_t window, PrepareFunction prepare)
+        : window_(window), prepare_(prepare)
+    {
+        for (int i = 0; i < threads; i++)
+            workers_.emplace_back(&FramePrefetcher::work, this, i);
+    }
+
+    ~FramePrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            changed_.notify_all();
+        }
+        for (auto &worker : workers_)
+            worker.join();
+        for (auto &ready : ready_)
+            av_frame_free(&ready.second);
+    }
+
+    FramePrefetcher(const FramePrefetcher &) = delete;
+    FramePrefetcher &operator=(const FramePrefetcher &) = delete;
+
+    /** Make items up to count available to the workers. */
+    void add(size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count > count_)
+            count_ = count;
+        changed_.notify_all();
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_ = true;
+        changed_.notify_all();
+    }
+
+    /**
+     * Wait for the next item in order. *frame is NULL if it was skipped.
+     * Returns false once finish() was called and every item was returned.
+     */
+    bool next(AVFrame **frame)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return ready_.count(next_out_) || (finished_ && next_out_ >= count_); });
+        auto ready = ready_.find(next_out_);
+        if (ready == ready_.end())
+            return false;
+        *frame = ready->second;
+        ready_.erase(ready);
+        next_out_++;
+        // the window moved, a worker may start another item
+        changed_.notify_all();
+        return true;
+    }
+
+private:
+    void work(int worker)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (1) {
+            changed_.wait(lock, [this] {
+                return stop_ || (next_in_ < count_ && next_in_ < next_out_ + window_);
+            });
+            if (stop_)
+                return;
+            size_t item = next_in_++;
+
+            lock.unlock();
+            AVFrame *frame = prepare_(item, worker);
+            lock.lock();
+
+            ready_[item] = frame;
+            changed_.notify_all();
+        }
+    }
+
+    size_t window_;
+    PrepareFunction prepare_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::map<size_t, AVFrame *> ready_; ///< reorder buffer
+    size_t count_ = 0; ///< items known so far
+    size_t next_in_ = 0; ///< next item a worker takes
+    size_t next_out_ = 0; ///< next item next() returns
+    bool finished_ = false;
+    bool stop_ = false;
+};
+
+#endif /* PREFETCH_H */
@@ -0,0 +1,215 @@
+/**
+ * Find the segments of a video that also appear in others, from the
+ * fingerprint indexes video2image writes (<output>.fpidx), without decoding
+ * anything again.
+ *
+ * Frames are matched on pHash Hamming distance. To avoid comparing every
+ * pair, library hashes are bucketed by each of their bands: with the 64 bits
+ * cut into distance + 1 bands (at least four, of 16 bits), two hashes within
+ * the distance necessarily share one, so no match is missed. Larger
+ * distances mean narrower bands and fuller buckets, so more candidates are
+ * compared. Matches of a copied segment all have about the same time
+ * offset between the two files, so matches are grouped by offset, and runs
+ * along that diagonal are reported as segments.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+extern "C"
+{
+#include <libavutil/common.h>
+#include <libavutil/log.h>
+}
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+
+#define MIN_BANDS 4
+#define MAX_BANDS 64
+#define OFFSET_TOLERANCE_MS 250
+#define MAX_MATCHES_PER_FRAME 64
+
+struct QueryOptions {
+    int max_distance = 10; ///< of the 64 pHash bits, re-encodes typically differ by 4 to 8
+    int64_t min_duration_ms = 5000; ///< shortest segment reported
+    int64_t max_gap_ms = 2000; ///< unmatched time tolerated inside a segment
+};
+
+struct FrameMatch {
+    int64_t query_ms;
+    int64_t library_ms;
+    int distance;
+
+    int64_t offset() const { return library_ms - query_ms; }
+};
+
+typedef std::unordered_map<uint64_t, std::vector<uint32_t>> BandTable;
+
+/* Bits [64 * b / bands, 64 * (b + 1) / bands) of hash. */
+static uint64_t band(uint64_t hash, int b, int bands)
+{
+    int first = 64 * b / bands, last = 64 * (b + 1) / bands;
+    uint64_t mask = last - first < 64 ? (UINT64_C(1) << (last - first)) - 1 : UINT64_MAX;
+    return (hash >> first) & mask;
+}
+
+/*
+ * Flat pictures (black, fades, slates) hash to a few bits set or cleared and
+ * match each other everywhere, they say nothing about the content.
+ */
+static bool is_informative(uint64_t hash)
+{
+    int bits = __builtin_popcountll(hash);
+    return bits >= 8 && bits <= 56;
+}
+
+static void format_time(char *buf, size_t size, int64_t ms)
+{
+    snprintf(buf, size, "%02d:%02d:%02d.%03d", (int)(ms / 3600000), (int)(ms / 60000 % 60),
+             (int)(ms / 1000 % 60), (int)(ms % 1000));
+}
+
+static std::vector<FrameMatch> match_frames(const FingerprintIndex &query, const FingerprintIndex &library,
+                                            const QueryOptions &options)
+{
+    int bands = av_clip(options.max_distance + 1, MIN_BANDS, MAX_BANDS);
+    std::vector<BandTable> tables(bands);
+    std::vector<uint64_t> seen(library.header->nb_entries, UINT64_MAX);
+    std::vector<FrameMatch> matches;
+    uint64_t i;
+
+    for (i = 0; i < library.header->nb_entries; i++) {
+        uint64_t hash = library.entries[i].phash;
+        if (!is_informative(hash))
+            continue;
+        for (int b = 0; b < bands; b++)
+            tables[b][band(hash, b, bands)].push_back((uint32_t)i);
+    }
+
+    for (i = 0; i < query.header->nb_entries; i++) {
+        const FingerprintEntry &q = query.entries[i];
+        int found = 0;
+        if (!is_informative(q.phash))
+            continue;
+        for (int b = 0; b < bands && found < MAX_MATCHES_PER_FRAME; b++) {
+            auto bucket = tables[b].find(band(q.phash, b, bands));
+            if (bucket == tables[b].end())
+                continue;
+            for (uint32_t candidate : bucket->second) {
+                // a candidate sharing several bands is only checked once
+                if (seen[candidate] == i)
+                    continue;
+                seen[candidate] = i;
+                const FingerprintEntry &l = library.entries[candidate];
+                int distance = fingerprint_distance(q.phash, l.phash);
+                if (distance > options.max_distance)
+                    continue;
+                matches.push_back({ q.pts_ms, l.pts_ms, distance });
+                if (++found >= MAX_MATCHES_PER_FRAME)
+                    break;
+            }
+        }
+    }
+    return matches;
+}
+
+/*
+ * Group matches with about the same offset, then split every group into runs
+ * where consecutive matches are at most max_gap apart.
+ */
+static int report_segments(std::vector<FrameMatch> &matches, const char *query_filename,
+                           const char *library_filename, const QueryOptions &options)
+{
+    size_t begin, end;
+    int segments = 0;
+
+    std::sort(matches.begin(), matches.end(),
+              [](const FrameMatch &a, const FrameMatch &b) { return a.offset() < b.offset(); });
+
+    for (begin = 0; begin < matches.size(); begin = end) {
+        for (end = begin + 1; end < matches.size() &&
+             matches[end].offset() - matches[end - 1].offset() <= OFFSET_TOLERANCE_MS; end++)
+            ;
+        std::sort(matches.begin() + begin, matches.begin() + end,
+                  [](const FrameMatch &a, const FrameMatch &b) { return a.query_ms < b.query_ms; });
+
+        size_t run = begin;
+        for (size_t j = begin + 1; j <= end; j++) {
+            if (j < end && matches[j].query_ms - matches[j - 1].query_ms <= options.max_gap_ms)
+                continue;
+            const FrameMatch &first = matches[run], &last = matches[j - 1];
+            if (last.query_ms - first.query_ms >= options.min_duration_ms) {
+                char q_from[32], q_to[32], l_from[32], l_to[32];
+                double distance = 0;
+                for (size_t k = run; k < j; k++)
+                    distance += matches[k].distance;
+                format_time(q_from, sizeof(q_from), first.query_ms);
+                format_time(q_to, sizeof(q_to), last.query_ms);
+                format_time(l_from, sizeof(l_from), first.library_ms);
+                format_time(l_to, sizeof(l_to), last.library_ms);
+                printf("%s %s-%s matches %s %s-%s (%zu frames, mean distance %.1f)\n",
+                       query_filename, q_from, q_to, library_filename, l_from, l_to,
+                       j - run, distance / (j - run));
+                segments++;
+            }
+            run = j;
+        }
+    }
+    return segments;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app (argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Find segments of a video that appear in other videos, using the\n"
+                                     ".fpidx fingerprint indexes written by video2image.");
+    QueryOptions options;
+    FingerprintIndex query;
+    int total = 0;
+
+    parser.addHelpOption();
+    parser.addPositionalArgument("query", "Fingerprint index of the video to look for.");
+    parser.addPositionalArgument("library", "Fingerprint indexes to search.", "<library>...");
+    QCommandLineOption distanceOption("distance", "Largest pHash Hamming distance of matching frames, 10 by default.", "bits");
+    parser.addOption(distanceOption);
+    QCommandLineOption durationOption("min-duration", "Shortest segment reported, 5 seconds by default.", "seconds");
+    parser.addOption(durationOption);
+    QCommandLineOption gapOption("max-gap", "Longest run of unmatched frames within a segment, 2 seconds by default.", "seconds");
+    parser.addOption(gapOption);
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() < 2)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Incorrect input\n");
+        return 1;
+    }
+    if (parser.isSet(distanceOption))
+        options.max_distance = parser.value(distanceOption).toInt();
+    if (parser.isSet(durationOption))
+        options.min_duration_ms = (int64_t)(parser.value(durationOption).toDouble() * 1000);
+    if (parser.isSet(gapOption))
+        options.max_gap_ms = (int64_t)(parser.value(gapOption).toDouble() * 1000);
+
+    const QByteArray query_filename = args.at(0).toLocal8Bit();
+    if (fingerprint_index_load(&query, query_filename.constData()) < 0)
+        return 1;
+
+    for (int i = 1; i < args.size(); i++)
+    {
+        FingerprintIndex library;
+        const QByteArray library_filename = args.at(i).toLocal8Bit();
+        if (fingerprint_index_load(&library, library_filename.constData()) < 0)
+            continue;
+        std::vector<FrameMatch> matches = match_frames(query, library, options);
+        total += report_segments(matches, query_filename.constData(), library_filename.constData(), options);
+        fingerprint_index_free(&library);
+    }
+    fingerprint_index_free(&query);
+
+    qDebug() << total << "matching segments";
+    return 0;
+}
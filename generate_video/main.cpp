@@ -3,21 +3,63 @@
  * @example encode_video.c
  *
  * Generate synthetic video data and encode it to an output file.
+ *
+ * With --benchmark, encode the same synthetic content with every
+ * combination of codec, preset, resolution and thread count instead, and
+ * write the encode speed, bitrate, CPU time and peak memory of each run to a
+ * CSV or JSON file.
  */
 
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QDebug>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <locale.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
 #include <opencv2/opencv.hpp>  // For reading images, optional if not using OpenCV
 extern "C" {
     #include <libavcodec/avcodec.h>
     #include <libavutil/opt.h>
     #include <libavutil/imgutils.h>
+    #include <libavutil/parseutils.h>
+    #include <libavutil/time.h>
+    #include <libavutil/pixdesc.h>
 }
+#include "test_pattern.h"
+
+// source frames pre-drawn for --benchmark
+#define BENCHMARK_RING 24
+
+struct GenerateOptions {
+    enum TestPattern pattern = TEST_PATTERN_GRADIENT;
+    enum AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+    int fill_threads = 0; ///< 0 for one per CPU
+
+    // --benchmark
+    QStringList codecs = { "libx264", "libx265" };
+    QStringList presets = { "ultrafast", "medium", "slow" };
+    QStringList sizes = { "640x360", "1280x720", "1920x1080" };
+    QList<int> threads = { 1, 4, 0 };
+    int frames = 120;
+};
+
+struct BenchmarkResult {
+    std::string codec;
+    std::string preset; ///< empty for codecs without presets
+    int width, height;
+    int threads; ///< as requested, 0 is the codec's automatic choice
+    int frames;
+    double seconds; ///< wall time spent in the encoder
+    double cpu_seconds; ///< user + system time of all encoder threads
+    int64_t bytes; ///< of all packets
+    long peak_rss_kb;
+};
 
 static void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
                    FILE *outfile)
@@ -49,37 +91,363 @@ static void encode(AVCodecContext *enc_ctx, AVFrame *frame, AVPacket *pkt,
     }
 }
 
+/* Prepare a dummy image for frame i.
+   In real code, this is where you would have your own logic for
+   filling the frame. FFmpeg does not care what you put in the
+   frame.
+ */
+static int fill_frame(AVFrame *frame, int i, const GenerateOptions &options)
+{
+    return test_pattern_fill(frame->data, frame->linesize, (enum AVPixelFormat)frame->format,
+                             frame->width, frame->height, options.pattern, i, FFMAX(options.fill_threads, 0));
+}
+
+static double process_cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * ru_maxrss never goes down over the life of the process, so every run would
+ * report the largest one so far. Linux can reset the high water mark through
+ * clear_refs; where it can't, fall back to ru_maxrss.
+ */
+static void reset_peak_rss()
+{
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    char line[256];
+    long kb = -1;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        fclose(f);
+    }
+    if (kb < 0) {
+        getrusage(RUSAGE_SELF, &usage);
+        kb = usage.ru_maxrss;
+    }
+    return kb;
+}
+
+static bool has_presets(const AVCodec *codec)
+{
+    return codec->priv_class &&
+           av_opt_find((void *)&codec->priv_class, "preset", NULL, 0, AV_OPT_SEARCH_FAKE_OBJ);
+}
+
+static int send_and_count(AVCodecContext *c, AVFrame *frame, AVPacket *pkt, int64_t *bytes)
+{
+    int ret = avcodec_send_frame(c, frame);
+    if (ret < 0)
+        return ret;
+    while (1) {
+        ret = avcodec_receive_packet(c, pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            return ret;
+        *bytes += pkt->size;
+        av_packet_unref(pkt);
+    }
+}
+
+/*
+ * Encode result->frames synthetic pictures and measure only the encoder. The
+ * pictures are drawn into a ring of frames before the clocks start and sent
+ * round robin; the ring is longer than any reference list (16 pictures for
+ * H.264/HEVC), so the encoder never finds an exact copy to predict from. The
+ * peak RSS includes the ring.
+ */
+static int benchmark_run(const AVCodec *codec, const GenerateOptions &options, BenchmarkResult *result)
+{
+    AVCodecContext *c = NULL;
+    AVFrame *ring[BENCHMARK_RING] = { NULL };
+    AVPacket *pkt = NULL;
+    double wall_start, cpu_start;
+    int ring_size = FFMIN(result->frames, BENCHMARK_RING);
+    int i, ret;
+
+    c = avcodec_alloc_context3(codec);
+    pkt = av_packet_alloc();
+    if (!c || !pkt) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    c->width = result->width;
+    c->height = result->height;
+    c->time_base = (AVRational){1, 25};
+    c->framerate = (AVRational){25, 1};
+    c->gop_size = 50;
+    c->pix_fmt = options.pix_fmt;
+    c->thread_count = result->threads;
+    if (!result->preset.empty()) {
+        ret = av_opt_set(c->priv_data, "preset", result->preset.c_str(), 0);
+        if (ret < 0) {
+            fprintf(stderr, "%s has no preset %s\n", codec->name, result->preset.c_str());
+            goto end;
+        }
+    }
+
+    ret = avcodec_open2(c, codec, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", codec->name, av_err2str(ret));
+        goto end;
+    }
+
+    for (i = 0; i < ring_size; i++) {
+        ring[i] = av_frame_alloc();
+        if (!ring[i]) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        ring[i]->format = c->pix_fmt;
+        ring[i]->width  = c->width;
+        ring[i]->height = c->height;
+        ret = av_frame_get_buffer(ring[i], 0);
+        if (ret < 0)
+            goto end;
+        ret = fill_frame(ring[i], i, options);
+        if (ret < 0)
+            goto end;
+    }
+
+    reset_peak_rss();
+    result->bytes = 0;
+    wall_start = av_gettime_relative() / 1e6;
+    cpu_start = process_cpu_seconds();
+    for (i = 0; i < result->frames; i++) {
+        // the encoder takes its own reference, the ring frame is never written again
+        AVFrame *frame = ring[i % ring_size];
+        frame->pts = i;
+        ret = send_and_count(c, frame, pkt, &result->bytes);
+        if (ret < 0)
+            break;
+    }
+    if (ret >= 0)
+        ret = send_and_count(c, NULL, pkt, &result->bytes);
+    if (ret < 0) {
+        fprintf(stderr, "Encoding with %s failed: %s\n", codec->name, av_err2str(ret));
+        goto end;
+    }
+    result->seconds = av_gettime_relative() / 1e6 - wall_start;
+    result->cpu_seconds = process_cpu_seconds() - cpu_start;
+    result->peak_rss_kb = peak_rss_kb();
+
+end:
+    avcodec_free_context(&c);
+    for (i = 0; i < ring_size; i++)
+        av_frame_free(&ring[i]);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static int write_results(const char *filename, const std::vector<BenchmarkResult> &results)
+{
+    const char *extension = strrchr(filename, '.');
+    bool json = extension && !strcasecmp(extension, ".json");
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return AVERROR(errno);
+    }
+
+    if (json)
+        fprintf(f, "[\n");
+    else
+        fprintf(f, "codec,preset,width,height,threads,frames,fps,bitrate_kbps,cpu_seconds,peak_rss_kb\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &r = results[i];
+        double fps = r.frames / r.seconds;
+        double kbps = r.bytes * 8 / (r.frames / 25.0) / 1000;
+        if (json)
+            fprintf(f, "  {\"codec\": \"%s\", \"preset\": \"%s\", \"width\": %d, \"height\": %d, "
+                       "\"threads\": %d, \"frames\": %d, \"fps\": %.2f, \"bitrate_kbps\": %.1f, "
+                       "\"cpu_seconds\": %.3f, \"peak_rss_kb\": %ld}%s\n",
+                    r.codec.c_str(), r.preset.c_str(), r.width, r.height, r.threads, r.frames,
+                    fps, kbps, r.cpu_seconds, r.peak_rss_kb, i + 1 < results.size() ? "," : "");
+        else
+            fprintf(f, "%s,%s,%d,%d,%d,%d,%.2f,%.1f,%.3f,%ld\n",
+                    r.codec.c_str(), r.preset.c_str(), r.width, r.height, r.threads, r.frames,
+                    fps, kbps, r.cpu_seconds, r.peak_rss_kb);
+    }
+    if (json)
+        fprintf(f, "]\n");
+
+    if (fclose(f)) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+static int run_benchmark(const char *filename, const GenerateOptions &options)
+{
+    std::vector<BenchmarkResult> results;
+
+    for (const QString &codec_name : options.codecs) {
+        const QByteArray name = codec_name.toLatin1();
+        const AVCodec *codec = avcodec_find_encoder_by_name(name.constData());
+        if (!codec || codec->type != AVMEDIA_TYPE_VIDEO) {
+            fprintf(stderr, "Video encoder '%s' not found, skipping it\n", name.constData());
+            continue;
+        }
+        // codecs without presets are measured once per size and thread count
+        QStringList presets = has_presets(codec) ? options.presets : QStringList{ QString() };
+
+        for (const QString &preset : presets) {
+            for (const QString &size : options.sizes) {
+                BenchmarkResult result;
+                if (av_parse_video_size(&result.width, &result.height, size.toLatin1().constData()) < 0) {
+                    fprintf(stderr, "Invalid size %s\n", qPrintable(size));
+                    return 1;
+                }
+                for (int threads : options.threads) {
+                    result.codec = codec->name;
+                    result.preset = preset.toStdString();
+                    result.threads = threads;
+                    result.frames = options.frames;
+                    if (benchmark_run(codec, options, &result) < 0)
+                        continue;
+                    printf("%s %s %dx%d threads=%d: %.1f fps, %.0f kbit/s, %.2f s CPU, %ld kB peak\n",
+                           result.codec.c_str(), result.preset.empty() ? "-" : result.preset.c_str(),
+                           result.width, result.height, threads, result.frames / result.seconds,
+                           result.bytes * 8 / (result.frames / 25.0) / 1000, result.cpu_seconds,
+                           result.peak_rss_kb);
+                    fflush(stdout);
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+
+    if (results.empty()) {
+        fprintf(stderr, "No encoder could be benchmarked\n");
+        return 1;
+    }
+    return write_results(filename, results) < 0 ? 1 : 0;
+}
+
+static QList<int> parse_int_list(const QString &value)
+{
+    QList<int> list;
+    for (const QString &item : value.split(',', Qt::SkipEmptyParts))
+        list.append(item.toInt());
+    return list;
+}
+
 int main(int argc, char **argv)
 {
-    const char *filename, *codec_name;
+    QCoreApplication app (argc, argv);
+    // QCoreApplication adopts the user locale, the JSON and CSV results need decimal points
+    setlocale(LC_NUMERIC, "C");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Encode synthetic video, or benchmark encoders on it.");
+    GenerateOptions options;
+    const char *filename, *codec_name = NULL;
     const AVCodec *codec;
     AVCodecContext *c= NULL;
-    int i, ret, x, y;
+    int i, ret;
     FILE *f;
     AVFrame *frame;
     AVPacket *pkt;
     uint8_t endcode[] = { 0, 0, 1, 0xb7 };
 
-    if (argc < 2) {
+    parser.addHelpOption();
+    parser.addPositionalArgument("output", "Output file, or the CSV or JSON results with --benchmark.");
+    parser.addPositionalArgument("codec", "Encoder name, H.264 by default. With --benchmark, the only codec\n"
+                                          "benchmarked.", "[codec]");
+    QCommandLineOption patternOption("pattern", "Test pattern: gradient (default), bars, noise, zoneplate or text.", "name");
+    parser.addOption(patternOption);
+    QCommandLineOption pixFmtOption("pix-fmt", "Pixel format fed to the encoder, yuv420p by default.", "format");
+    parser.addOption(pixFmtOption);
+    QCommandLineOption fillThreadsOption("fill-threads", "Threads drawing the test pattern, 0 (the default) for one per CPU.", "count");
+    parser.addOption(fillThreadsOption);
+    QCommandLineOption benchmarkOption("benchmark", "Measure encoders on every combination of the lists below\n"
+                                                    "instead; results go to a .json file as JSON, otherwise CSV.");
+    parser.addOption(benchmarkOption);
+    QCommandLineOption codecsOption("codecs", "Encoders to benchmark, libx264,libx265 by default.", "list");
+    parser.addOption(codecsOption);
+    QCommandLineOption presetsOption("presets", "Presets to benchmark, ultrafast,medium,slow by default.", "list");
+    parser.addOption(presetsOption);
+    QCommandLineOption sizesOption("sizes", "Resolutions to benchmark, 640x360,1280x720,1920x1080 by default.", "list");
+    parser.addOption(sizesOption);
+    QCommandLineOption threadsOption("threads", "Encoder thread counts to benchmark, 1,4,0 by default (0 is automatic).", "list");
+    parser.addOption(threadsOption);
+    QCommandLineOption framesOption("frames", "Frames encoded per benchmark run, 120 by default.", "count");
+    parser.addOption(framesOption);
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() < 1) {
         fprintf(stderr, "Usage: %s <output file> <codec name>\n", argv[0]);
         exit(0);
     }
-    filename = argv[1];
-    // codec_name = argv[2];
+    const QByteArray output = args.at(0).toLocal8Bit();
+    const QByteArray codec_arg = args.size() > 1 ? args.at(1).toLatin1() : QByteArray();
+    filename = output.constData();
+    if (!codec_arg.isEmpty())
+        codec_name = codec_arg.constData();
 
-    /* find the mpeg1video encoder */
-    /*
-    codec = avcodec_find_encoder_by_name(codec_name);
-    if (!codec) {
-        fprintf(stderr, "Codec '%s' not found\n", codec_name);
-        exit(1);
+    if (parser.isSet(patternOption) &&
+        test_pattern_from_name(&options.pattern, parser.value(patternOption).toLatin1().constData()) < 0)
+        return 1;
+    if (parser.isSet(pixFmtOption)) {
+        options.pix_fmt = av_get_pix_fmt(parser.value(pixFmtOption).toLatin1().constData());
+        if (!test_pattern_supports(options.pix_fmt)) {
+            fprintf(stderr, "Unsupported pixel format %s\n", qPrintable(parser.value(pixFmtOption)));
+            return 1;
+        }
     }
-    */
+    if (parser.isSet(fillThreadsOption))
+        options.fill_threads = parser.value(fillThreadsOption).toInt();
 
-    codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if (!codec) {
-        qDebug() << "H.264 codec not found";
-        exit(1);
+    if (parser.isSet(benchmarkOption)) {
+        if (codec_name)
+            options.codecs = QStringList{ args.at(1) };
+        else if (parser.isSet(codecsOption))
+            options.codecs = parser.value(codecsOption).split(',', Qt::SkipEmptyParts);
+        if (parser.isSet(presetsOption))
+            options.presets = parser.value(presetsOption).split(',', Qt::SkipEmptyParts);
+        if (parser.isSet(sizesOption))
+            options.sizes = parser.value(sizesOption).split(',', Qt::SkipEmptyParts);
+        if (parser.isSet(threadsOption))
+            options.threads = parse_int_list(parser.value(threadsOption));
+        if (parser.isSet(framesOption))
+            options.frames = parser.value(framesOption).toInt();
+        if (options.frames <= 0) {
+            fprintf(stderr, "Invalid frame count\n");
+            return 1;
+        }
+        return run_benchmark(filename, options);
+    }
+
+    if (codec_name) {
+        codec = avcodec_find_encoder_by_name(codec_name);
+        if (!codec) {
+            fprintf(stderr, "Codec '%s' not found\n", codec_name);
+            exit(1);
+        }
+    } else {
+        codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+        if (!codec) {
+            qDebug() << "H.264 codec not found";
+            exit(1);
+        }
     }
 
     c = avcodec_alloc_context3(codec);
@@ -109,7 +477,7 @@ int main(int argc, char **argv)
      */
     c->gop_size = 10;
     c->max_b_frames = 1;
-    c->pix_fmt = AV_PIX_FMT_YUV420P;
+    c->pix_fmt = options.pix_fmt;
 
     if (codec->id == AV_CODEC_ID_H264)
         av_opt_set(c->priv_data, "preset", "slow", 0);
@@ -160,25 +528,8 @@ int main(int argc, char **argv)
         if (ret < 0)
             exit(1);
 
-        /* Prepare a dummy image.
-           In real code, this is where you would have your own logic for
-           filling the frame. FFmpeg does not care what you put in the
-           frame.
-         */
-        /* Y */
-        for (y = 0; y < c->height; y++) {
-            for (x = 0; x < c->width; x++) {
-                frame->data[0][y * frame->linesize[0] + x] = x + y + i * 3;
-            }
-        }
-
-        /* Cb and Cr */
-        for (y = 0; y < c->height/2; y++) {
-            for (x = 0; x < c->width/2; x++) {
-                frame->data[1][y * frame->linesize[1] + x] = 128 + y + i * 2;
-                frame->data[2][y * frame->linesize[2] + x] = 64 + x + i * 5;
-            }
-        }
+        if (fill_frame(frame, i, options) < 0)
+            exit(1);
 
         frame->pts = i;
 
@@ -21,6 +21,7 @@ extern "C"
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include "packet_index.h"
 
 // print out the steps and errors
 static void logging(const char *fmt, ...);
@@ -28,6 +29,8 @@ static void logging(const char *fmt, ...);
 static int decode_packet(AVPacket *pPacket, AVCodecContext *pCodecContext, AVFrame *pFrame);
 // save a frame into a .pgm file
 static void save_gray_frame(unsigned char *buf, int wrap, int xsize, int ysize, char *filename);
+// print what the sidecar packet index knows about the file, if there is one
+static int load_packet_index(PacketIndex *index, const char *media_filename);
 
 int main(int argc, const char *argv[])
 {
@@ -35,6 +38,7 @@ int main(int argc, const char *argv[])
     if (argc < 2)
     {
         printf("You need to specify a media file.\n");
+        printf("usage: %s <media file> [start seconds]\n", argv[0]);
         return -1;
     }
 
@@ -198,6 +202,26 @@ int main(int argc, const char *argv[])
     int response = 0;
     int how_many_packets_to_process = 8;
 
+    // with a sidecar index (see index_packets) we can jump straight to the
+    // byte offset of the keyframe before the requested time, instead of
+    // letting the demuxer probe its way there
+    PacketIndex packetIndex;
+    int has_packet_index = load_packet_index(&packetIndex, argv[1]) >= 0;
+    if (argc > 2)
+    {
+        AVStream *pStream = pFormatContext->streams[video_stream_index];
+        int64_t start = av_rescale_q((int64_t)(atof(argv[2]) * AV_TIME_BASE), AV_TIME_BASE_Q, pStream->time_base);
+        if (pStream->start_time != AV_NOPTS_VALUE)
+            start += pStream->start_time;
+        if (has_packet_index)
+            response = packet_index_seek(pFormatContext, &packetIndex, video_stream_index, start);
+        else
+            response = av_seek_frame(pFormatContext, video_stream_index, start, AVSEEK_FLAG_BACKWARD);
+        if (response < 0)
+            logging("failed to seek to %s seconds: %s", argv[2], av_err2str(response));
+        response = 0;
+    }
+
     // fill the Packet with data from the Stream
     // https://ffmpeg.org/doxygen/trunk/group__lavf__decoding.html#ga4fdb3084415a82e3810de6ee60e46a61
     while (av_read_frame(pFormatContext, pPacket) >= 0)
@@ -219,6 +243,9 @@ int main(int argc, const char *argv[])
 
     logging("releasing all the resources");
 
+    if (has_packet_index)
+        packet_index_free(&packetIndex);
+
     avformat_close_input(&pFormatContext);
     av_packet_free(&pPacket);
     av_frame_free(&pFrame);
@@ -319,4 +346,38 @@ static void save_gray_frame(unsigned char *buf, int wrap, int xsize, int ysize,
     for (i = 0; i < ysize; i++)
         fwrite(buf + i * wrap, 1, xsize, f);
     fclose(f);
-}
\ No newline at end of file
+}
+
+static int load_packet_index(PacketIndex *index, const char *media_filename)
+{
+    char *index_filename = packet_index_filename(media_filename);
+    int ret;
+
+    if (!index_filename)
+        return AVERROR(ENOMEM);
+    ret = packet_index_load(index, index_filename);
+    if (ret < 0)
+    {
+        av_free(index_filename);
+        return ret;
+    }
+
+    logging("packet index %s: %" PRIu64 " packets, media size %" PRId64,
+            index_filename, index->header->nb_entries, index->header->media_size);
+    for (uint32_t i = 0; i < index->header->nb_streams; i++)
+    {
+        const PacketIndexStream *st = &index->streams[i];
+        const PacketIndexEntry *entries = index->entries + st->first_entry;
+        uint64_t keyframes = 0;
+        int64_t bytes = 0;
+        for (uint64_t j = 0; j < st->nb_entries; j++)
+        {
+            keyframes += !!(entries[j].flags & AV_PKT_FLAG_KEY);
+            bytes += entries[j].size;
+        }
+        logging("\tstream %u: %" PRIu64 " packets, %" PRIu64 " keyframes, %" PRId64 " bytes, time_base %d/%d",
+                i, st->nb_entries, keyframes, bytes, st->time_base_num, st->time_base_den);
+    }
+    av_free(index_filename);
+    return 0;
+}
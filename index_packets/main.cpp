@@ -0,0 +1,79 @@
+/**
+ * Build a sidecar packet index ("<input>.pktidx") for a media file, so tools
+ * can seek straight to a byte offset instead of scanning containers that
+ * have no native index (e.g. MPEG-TS).
+ */
+#include <QCoreApplication>
+#include <QDebug>
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+}
+#include "packet_index.h"
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    AVFormatContext *fmt_ctx = NULL;
+    PacketIndex index;
+    char *index_filename = NULL;
+    unsigned int i;
+    int ret;
+
+    if (argc < 2)
+    {
+        qDebug() << "usage: " << argv[0] << "<input file> [index file]\n";
+        return 1;
+    }
+
+    if ((ret = avformat_open_input(&fmt_ctx, argv[1], NULL, NULL)) < 0)
+    {
+        qDebug() << "Could not open input file " << argv[1];
+        return 1;
+    }
+    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+    {
+        qDebug() << "Failed to retrieve input stream information";
+        goto end;
+    }
+
+    index_filename = argc > 2 ? av_strdup(argv[2]) : packet_index_filename(argv[1]);
+    if (!index_filename)
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    if ((ret = packet_index_build(fmt_ctx, index_filename)) < 0)
+    {
+        qDebug() << "Failed to build packet index";
+        goto end;
+    }
+
+    // read it back the way consumers will, as a check and for the summary
+    if ((ret = packet_index_load(&index, index_filename)) < 0)
+        goto end;
+    qDebug() << "wrote" << index_filename << ":" << index.header->nb_entries << "packets";
+    for (i = 0; i < index.header->nb_streams; i++)
+    {
+        const PacketIndexStream *st = &index.streams[i];
+        uint64_t keyframes = 0, j;
+        for (j = 0; j < st->nb_entries; j++)
+            keyframes += !!(index.entries[st->first_entry + j].flags & AV_PKT_FLAG_KEY);
+        qDebug() << "stream" << i << av_get_media_type_string((enum AVMediaType)st->codec_type)
+                 << "packets" << st->nb_entries << "keyframes" << keyframes;
+    }
+    packet_index_free(&index);
+
+end:
+    avformat_close_input(&fmt_ctx);
+    av_free(index_filename);
+    if (ret < 0)
+    {
+        qDebug() << "Error occurred: " << av_err2str(ret);
+        return 1;
+    }
+    return 0;
+}
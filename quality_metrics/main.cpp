@@ -0,0 +1,376 @@
+/**
+ * Full reference quality metrics: decode a reference and a distorted video in
+ * lockstep and report PSNR and SSIM of every frame and of the whole file, as
+ * JSON.
+ *
+ * Frames are compared in 8 bit YUV 4:2:0 at the reference size; the
+ * distorted video is scaled and converted to that when it differs, so a
+ * rendition of a ladder can be scored against its source directly. Each frame
+ * is split in bands of rows measured by several threads at once.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <locale.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+extern "C"
+{
+    #include <libavcodec/avcodec.h>
+    #include <libavformat/avformat.h>
+    #include <libavutil/cpu.h>
+    #include <libavutil/imgutils.h>
+    #include <libswscale/swscale.h>
+}
+#include "metrics.h"
+
+#define MAX_PSNR 100.0 // reported for identical planes
+
+struct MetricsOptions {
+    int threads = 0; ///< 0 for one per CPU
+    int64_t max_frames = 0; ///< 0 for all
+};
+
+struct VideoInput {
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *dec_ctx = NULL;
+    AVPacket *pkt = NULL;
+    AVFrame *frame = NULL; ///< last decoded
+    AVFrame *converted = NULL; ///< frame as 8 bit 4:2:0 at the reference size
+    struct SwsContext *sws_ctx = NULL;
+    int stream = -1;
+    bool draining = false;
+};
+
+/* What one thread measured on its bands of a frame. */
+struct PlaneSums {
+    uint64_t sse[3] = {};
+    double ssim[3] = {};
+    int64_t windows[3] = {};
+};
+
+struct FrameScore {
+    double psnr[4]; ///< Y, Cb, Cr, all planes
+    double ssim[4];
+};
+
+static int open_input(VideoInput *in, const char *filename)
+{
+    const AVCodec *codec;
+    int ret;
+
+    if ((ret = avformat_open_input(&in->fmt_ctx, filename, NULL, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open %s\n", filename);
+        return ret;
+    }
+    if ((ret = avformat_find_stream_info(in->fmt_ctx, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't get stream info of %s\n", filename);
+        return ret;
+    }
+    in->stream = av_find_best_stream(in->fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (in->stream < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't find a video stream in %s\n", filename);
+        return in->stream;
+    }
+
+    in->dec_ctx = avcodec_alloc_context3(codec);
+    in->pkt = av_packet_alloc();
+    in->frame = av_frame_alloc();
+    in->converted = av_frame_alloc();
+    if (!in->dec_ctx || !in->pkt || !in->frame || !in->converted)
+        return AVERROR(ENOMEM);
+    ret = avcodec_parameters_to_context(in->dec_ctx, in->fmt_ctx->streams[in->stream]->codecpar);
+    if (ret < 0)
+        return ret;
+    in->dec_ctx->thread_count = 0;
+    if ((ret = avcodec_open2(in->dec_ctx, codec, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open the decoder of %s\n", filename);
+        return ret;
+    }
+    return 0;
+}
+
+static void close_input(VideoInput *in)
+{
+    sws_freeContext(in->sws_ctx);
+    av_frame_free(&in->converted);
+    av_frame_free(&in->frame);
+    av_packet_free(&in->pkt);
+    avcodec_free_context(&in->dec_ctx);
+    avformat_close_input(&in->fmt_ctx);
+}
+
+/* Decode the next frame into in->frame; AVERROR_EOF at the end of the stream. */
+static int read_frame(VideoInput *in)
+{
+    while (1) {
+        int ret = avcodec_receive_frame(in->dec_ctx, in->frame);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+
+        ret = av_read_frame(in->fmt_ctx, in->pkt);
+        if (ret == AVERROR_EOF && !in->draining) {
+            in->draining = true;
+            ret = avcodec_send_packet(in->dec_ctx, NULL);
+            if (ret < 0)
+                return ret;
+            continue;
+        }
+        if (ret < 0)
+            return ret;
+        if (in->pkt->stream_index == in->stream)
+            ret = avcodec_send_packet(in->dec_ctx, in->pkt);
+        av_packet_unref(in->pkt);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+/*
+ * The last frame of in as 8 bit 4:2:0 at width x height: the decoded frame
+ * itself when it already is, else scaled into in->converted.
+ */
+static const AVFrame *comparable_frame(VideoInput *in, int width, int height)
+{
+    AVFrame *src = in->frame, *dst = in->converted;
+
+    if (src->format == AV_PIX_FMT_YUV420P && src->width == width && src->height == height)
+        return src;
+
+    if (dst->width != width || dst->height != height) {
+        av_frame_unref(dst);
+        dst->format = AV_PIX_FMT_YUV420P;
+        dst->width = width;
+        dst->height = height;
+        if (av_frame_get_buffer(dst, 0) < 0)
+            return NULL;
+    }
+    in->sws_ctx = sws_getCachedContext(in->sws_ctx, src->width, src->height, (enum AVPixelFormat)src->format,
+                                       width, height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
+    if (!in->sws_ctx)
+        return NULL;
+    sws_scale(in->sws_ctx, src->data, src->linesize, 0, src->height, dst->data, dst->linesize);
+    return dst;
+}
+
+/* Measure band index of count of every plane. */
+static void measure_band(const AVFrame *a, const AVFrame *b, int index, int count, PlaneSums *sums)
+{
+    for (int p = 0; p < 3; p++) {
+        int width = p ? AV_CEIL_RSHIFT(a->width, 1) : a->width;
+        int height = p ? AV_CEIL_RSHIFT(a->height, 1) : a->height;
+        int rows = ssim_window_rows(height);
+
+        sums->sse[p] = plane_sse(a->data[p], a->linesize[p], b->data[p], b->linesize[p], width,
+                                 height * index / count, height * (index + 1) / count);
+        sums->ssim[p] = plane_ssim(a->data[p], a->linesize[p], b->data[p], b->linesize[p], width,
+                                   rows * index / count, rows * (index + 1) / count, &sums->windows[p]);
+    }
+}
+
+static double psnr(uint64_t sse, uint64_t samples)
+{
+    if (!sse)
+        return MAX_PSNR;
+    return FFMIN(10 * log10(255.0 * 255.0 * samples / sse), MAX_PSNR);
+}
+
+static FrameScore score(const PlaneSums &sums, const int samples[3])
+{
+    FrameScore s;
+    uint64_t sse = 0, total = 0;
+    double ssim = 0;
+
+    for (int p = 0; p < 3; p++) {
+        s.psnr[p] = psnr(sums.sse[p], samples[p]);
+        s.ssim[p] = sums.windows[p] ? sums.ssim[p] / sums.windows[p] : 1.0;
+        sse += sums.sse[p];
+        total += samples[p];
+        ssim += s.ssim[p] * samples[p];
+    }
+    // planes weighted by their number of samples, like FFmpeg's psnr and ssim filters
+    s.psnr[3] = psnr(sse, total);
+    s.ssim[3] = ssim / total;
+    return s;
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void json_score(FILE *f, const FrameScore &s)
+{
+    fprintf(f, "\"psnr_y\": %.4f, \"psnr_u\": %.4f, \"psnr_v\": %.4f, \"psnr\": %.4f, "
+               "\"ssim_y\": %.6f, \"ssim_u\": %.6f, \"ssim_v\": %.6f, \"ssim\": %.6f",
+            s.psnr[0], s.psnr[1], s.psnr[2], s.psnr[3], s.ssim[0], s.ssim[1], s.ssim[2], s.ssim[3]);
+}
+
+static int measure(const char *reference_filename, const char *distorted_filename, FILE *out,
+                   const MetricsOptions &options)
+{
+    VideoInput reference, distorted;
+    PlaneSums totals;
+    std::vector<PlaneSums> bands;
+    double ssim_sum[4] = {}, min_psnr = MAX_PSNR, min_ssim = 1.0;
+    int samples[3];
+    int64_t frames = 0;
+    int threads = options.threads > 0 ? options.threads : av_cpu_count();
+    int width, height, ret;
+
+    if ((ret = open_input(&reference, reference_filename)) < 0 ||
+        (ret = open_input(&distorted, distorted_filename)) < 0)
+        goto end;
+    width = reference.dec_ctx->width;
+    height = reference.dec_ctx->height;
+    samples[0] = width * height;
+    samples[1] = samples[2] = AV_CEIL_RSHIFT(width, 1) * AV_CEIL_RSHIFT(height, 1);
+    bands.resize(threads);
+
+    fprintf(out, "{\n  \"reference\": ");
+    json_string(out, reference_filename);
+    fprintf(out, ",\n  \"distorted\": ");
+    json_string(out, distorted_filename);
+    fprintf(out, ",\n  \"width\": %d,\n  \"height\": %d,\n  \"frames\": [", width, height);
+
+    while (!options.max_frames || frames < options.max_frames) {
+        int ret_ref = read_frame(&reference);
+        int ret_dist = read_frame(&distorted);
+        if (ret_ref == AVERROR_EOF || ret_dist == AVERROR_EOF) {
+            if (ret_ref != ret_dist)
+                av_log(NULL, AV_LOG_WARNING, "%s ended first, after %" PRId64 " frames\n",
+                       ret_ref == AVERROR_EOF ? reference_filename : distorted_filename, frames);
+            break;
+        }
+        if ((ret = ret_ref) < 0 || (ret = ret_dist) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Decoding failed: %s\n", av_err2str(ret));
+            goto end;
+        }
+
+        const AVFrame *a = comparable_frame(&reference, width, height);
+        const AVFrame *b = comparable_frame(&distorted, width, height);
+        if (!a || !b) {
+            av_log(NULL, AV_LOG_ERROR, "Can't convert frame %" PRId64 "\n", frames);
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; i++)
+            workers.emplace_back(measure_band, a, b, i, threads, &bands[i]);
+        measure_band(a, b, 0, threads, &bands[0]);
+        for (auto &worker : workers)
+            worker.join();
+
+        PlaneSums sums;
+        for (const PlaneSums &band : bands) {
+            for (int p = 0; p < 3; p++) {
+                sums.sse[p] += band.sse[p];
+                sums.ssim[p] += band.ssim[p];
+                sums.windows[p] += band.windows[p];
+            }
+        }
+        FrameScore s = score(sums, samples);
+        for (int p = 0; p < 3; p++)
+            totals.sse[p] += sums.sse[p];
+        for (int i = 0; i < 4; i++)
+            ssim_sum[i] += s.ssim[i];
+        min_psnr = FFMIN(min_psnr, s.psnr[3]);
+        min_ssim = FFMIN(min_ssim, s.ssim[3]);
+
+        fprintf(out, "%s\n    {\"frame\": %" PRId64 ", ", frames ? "," : "", frames);
+        json_score(out, s);
+        fprintf(out, "}");
+        frames++;
+    }
+
+    if (!frames) {
+        av_log(NULL, AV_LOG_ERROR, "No frames to compare\n");
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    {
+        // PSNR of the mean squared error over all frames, mean SSIM
+        int64_t all[3] = { samples[0] * frames, samples[1] * frames, samples[2] * frames };
+        FrameScore mean;
+        for (int p = 0; p < 3; p++)
+            mean.psnr[p] = psnr(totals.sse[p], all[p]);
+        mean.psnr[3] = psnr(totals.sse[0] + totals.sse[1] + totals.sse[2], all[0] + all[1] + all[2]);
+        for (int i = 0; i < 4; i++)
+            mean.ssim[i] = ssim_sum[i] / frames;
+
+        fprintf(out, "\n  ],\n  \"aggregate\": {\"frames\": %" PRId64 ", ", frames);
+        json_score(out, mean);
+        fprintf(out, ", \"psnr_min\": %.4f, \"ssim_min\": %.6f}\n}\n", min_psnr, min_ssim);
+        qDebug() << frames << "frames, PSNR" << mean.psnr[3] << "dB, SSIM" << mean.ssim[3];
+    }
+    ret = 0;
+
+end:
+    close_input(&reference);
+    close_input(&distorted);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app (argc, argv);
+    // QCoreApplication adopts the user locale, the JSON needs decimal points
+    setlocale(LC_NUMERIC, "C");
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measure the PSNR and SSIM of a distorted video against its reference,\n"
+                                     "frame by frame, as JSON.");
+    MetricsOptions options;
+    FILE *out = stdout;
+    int ret;
+
+    parser.addHelpOption();
+    parser.addPositionalArgument("reference", "Reference video.");
+    parser.addPositionalArgument("distorted", "Video to score, scaled to the reference size if needed.");
+    parser.addPositionalArgument("json", "Output file, standard output by default.", "[json]");
+    QCommandLineOption threadsOption("threads", "Threads measuring each frame, one per CPU by default.", "count");
+    parser.addOption(threadsOption);
+    QCommandLineOption framesOption("frames", "Compare at most this many frames.", "count");
+    parser.addOption(framesOption);
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() < 2)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Incorrect input\n");
+        return 1;
+    }
+    if (parser.isSet(threadsOption))
+        options.threads = parser.value(threadsOption).toInt();
+    if (parser.isSet(framesOption))
+        options.max_frames = parser.value(framesOption).toLongLong();
+
+    const QByteArray reference_filename = args.at(0).toLocal8Bit();
+    const QByteArray distorted_filename = args.at(1).toLocal8Bit();
+    if (args.size() > 2) {
+        const QByteArray json_filename = args.at(2).toLocal8Bit();
+        out = fopen(json_filename.constData(), "w");
+        if (!out) {
+            av_log(NULL, AV_LOG_ERROR, "Can't open %s\n", json_filename.constData());
+            return 1;
+        }
+    }
+
+    ret = measure(reference_filename.constData(), distorted_filename.constData(), out, options);
+    if (out != stdout && fclose(out) && ret >= 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't write the results\n");
+        ret = AVERROR(EIO);
+    }
+    return ret < 0 ? 1 : 0;
+}
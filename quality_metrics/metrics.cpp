@@ -0,0 +1,180 @@
+#include "metrics.h"
+
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+extern "C"
+{
+    #include <libavutil/cpu.h>
+}
+
+/* Of a 4x4 block: s1, s2 sums of a and b; ss sum of a^2 + b^2; s12 sum of a * b. */
+struct BlockSums {
+    int s[4];
+};
+
+static bool have_avx2()
+{
+    return HAVE_X86 && (av_get_cpu_flags() & AV_CPU_FLAG_AVX2);
+}
+
+static uint64_t sse_row_c(const uint8_t *a, const uint8_t *b, int n)
+{
+    uint64_t sum = 0;
+    for (int x = 0; x < n; x++) {
+        int d = a[x] - b[x];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static void block_sums_c(const uint8_t *a, int a_linesize, const uint8_t *b, int b_linesize,
+                         int blocks, BlockSums *sums)
+{
+    for (int z = 0; z < blocks; z++) {
+        int s1 = 0, s2 = 0, ss = 0, s12 = 0;
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                int pa = a[y * a_linesize + 4 * z + x];
+                int pb = b[y * b_linesize + 4 * z + x];
+                s1 += pa;
+                s2 += pb;
+                ss += pa * pa + pb * pb;
+                s12 += pa * pb;
+            }
+        }
+        sums[z].s[0] = s1;
+        sums[z].s[1] = s2;
+        sums[z].s[2] = ss;
+        sums[z].s[3] = s12;
+    }
+}
+
+#if HAVE_X86
+/* 32 pixels per iteration; a row would need over 250000 pixels to overflow the 32 bit lanes. */
+__attribute__((target("avx2")))
+static uint64_t sse_row_avx2(const uint8_t *a, const uint8_t *b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int x;
+
+    for (x = 0; x + 32 <= n; x += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + x));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + x));
+        __m256i zero = _mm256_setzero_si256();
+        __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+        __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+        acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+    }
+    __m256i wide = _mm256_add_epi64(_mm256_unpacklo_epi32(acc, _mm256_setzero_si256()),
+                                    _mm256_unpackhi_epi32(acc, _mm256_setzero_si256()));
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(wide), _mm256_extracti128_si256(wide, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (uint64_t)_mm_cvtsi128_si64(sum) + sse_row_c(a + x, b + x, n - x);
+}
+
+/* Four blocks, 16 pixels of 4 rows, per iteration. */
+__attribute__((target("avx2")))
+static void block_sums_avx2(const uint8_t *a, int a_linesize, const uint8_t *b, int b_linesize,
+                            int blocks, BlockSums *sums)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    int z;
+
+    for (z = 0; z + 4 <= blocks; z += 4) {
+        __m256i sa = _mm256_setzero_si256(), sb = _mm256_setzero_si256();
+        __m256i ss = _mm256_setzero_si256(), s12 = _mm256_setzero_si256();
+        for (int y = 0; y < 4; y++) {
+            __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(a + y * a_linesize + 4 * z)));
+            __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b + y * b_linesize + 4 * z)));
+            sa = _mm256_add_epi16(sa, va);
+            sb = _mm256_add_epi16(sb, vb);
+            ss = _mm256_add_epi32(ss, _mm256_add_epi32(_mm256_madd_epi16(va, va), _mm256_madd_epi16(vb, vb)));
+            s12 = _mm256_add_epi32(s12, _mm256_madd_epi16(va, vb));
+        }
+        // 32 bit lanes 2k and 2k + 1 hold block k; hadd works within 128 bit
+        // halves, giving s1 s1 s2 s2 of blocks 0 1, then of blocks 2 3
+        int t[8], u[8];
+        _mm256_storeu_si256((__m256i *)t, _mm256_hadd_epi32(_mm256_madd_epi16(sa, ones), _mm256_madd_epi16(sb, ones)));
+        _mm256_storeu_si256((__m256i *)u, _mm256_hadd_epi32(ss, s12));
+        for (int k = 0; k < 4; k++) {
+            int i = (k >> 1) * 4 + (k & 1);
+            sums[z + k].s[0] = t[i];
+            sums[z + k].s[1] = t[i + 2];
+            sums[z + k].s[2] = u[i];
+            sums[z + k].s[3] = u[i + 2];
+        }
+    }
+    block_sums_c(a + 4 * z, a_linesize, b + 4 * z, b_linesize, blocks - z, sums + z);
+}
+#endif
+
+uint64_t plane_sse(const uint8_t *a, int a_linesize, const uint8_t *b, int b_linesize,
+                   int width, int y0, int y1)
+{
+    uint64_t (*sse_row)(const uint8_t *, const uint8_t *, int) = sse_row_c;
+    uint64_t sum = 0;
+
+#if HAVE_X86
+    if (have_avx2())
+        sse_row = sse_row_avx2;
+#endif
+    for (int y = y0; y < y1; y++)
+        sum += sse_row(a + y * a_linesize, b + y * b_linesize, width);
+    return sum;
+}
+
+int ssim_window_rows(int height)
+{
+    return height >= 8 ? height / 4 - 1 : 0;
+}
+
+/* SSIM of one 8x8 window from the sums of its four blocks, scaled by 64. */
+static float ssim_end(int s1, int s2, int ss, int s12)
+{
+    static const int c1 = (int)(.01 * .01 * 255 * 255 * 64 + .5);
+    static const int c2 = (int)(.03 * .03 * 255 * 255 * 64 * 63 + .5);
+    int vars = ss * 64 - s1 * s1 - s2 * s2;
+    int covar = s12 * 64 - s1 * s2;
+
+    return (float)(2 * s1 * s2 + c1) * (float)(2 * covar + c2) /
+           ((float)(s1 * s1 + s2 * s2 + c1) * (float)(vars + c2));
+}
+
+double plane_ssim(const uint8_t *a, int a_linesize, const uint8_t *b, int b_linesize,
+                  int width, int row0, int row1, int64_t *windows)
+{
+    void (*block_sums)(const uint8_t *, int, const uint8_t *, int, int, BlockSums *) = block_sums_c;
+    int blocks = width / 4;
+    int columns = blocks - 1;
+    std::vector<BlockSums> top(blocks), bottom(blocks);
+    double sum = 0;
+
+    *windows = 0;
+    if (columns <= 0 || row0 >= row1)
+        return 0;
+#if HAVE_X86
+    if (have_avx2())
+        block_sums = block_sums_avx2;
+#endif
+
+    block_sums(a + 4 * row0 * a_linesize, a_linesize, b + 4 * row0 * b_linesize, b_linesize, blocks, top.data());
+    for (int row = row0; row < row1; row++) {
+        block_sums(a + 4 * (row + 1) * a_linesize, a_linesize, b + 4 * (row + 1) * b_linesize, b_linesize,
+                   blocks, bottom.data());
+        for (int x = 0; x < columns; x++) {
+            int s[4];
+            for (int i = 0; i < 4; i++)
+                s[i] = top[x].s[i] + top[x + 1].s[i] + bottom[x].s[i] + bottom[x + 1].s[i];
+            sum += ssim_end(s[0], s[1], s[2], s[3]);
+        }
+        std::swap(top, bottom);
+    }
+    *windows = (int64_t)(row1 - row0) * columns;
+    return sum;
+}
@@ -0,0 +1,28 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+/**
+ * Full reference metrics on 8 bit planes, split so several threads can each
+ * take a band of rows of the same plane and add up their results.
+ *
+ * SSIM follows the x264/FFmpeg approach: sums over 4x4 blocks, combined into
+ * 8x8 windows every 4 pixels, averaged over the plane.
+ */
+
+/** Sum of squared differences over rows [y0, y1) of two width wide planes. */
+uint64_t plane_sse(const uint8_t *a, int a_linesize, const uint8_t *b, int b_linesize,
+                   int width, int y0, int y1);
+
+/** Number of window rows of a plane of this height; 0 if it is too small. */
+int ssim_window_rows(int height);
+
+/**
+ * Sum of the SSIM of the windows in window rows [row0, row1); *windows is
+ * set to their number.
+ */
+double plane_ssim(const uint8_t *a, int a_linesize, const uint8_t *b, int b_linesize,
+                  int width, int row0, int row1, int64_t *windows);
+
+#endif /* METRICS_H */
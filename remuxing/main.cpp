@@ -13,6 +13,62 @@ extern "C"
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
+#include "packet_index.h"
+
+// worst case per-sample cost of the sample tables in the moov box: a chunk per
+// sample (co64 8 + stsc 12), stsz 4, stts 8, ctts 8, stss 4, sdtp 1, rounded
+// up; plus a fixed allowance for the per-track and per-file boxes
+#define MOOV_BYTES_PER_PACKET 48
+#define MOOV_BYTES_PER_STREAM 1024
+#define MOOV_BYTES_BASE       4096
+
+/*
+ * Estimate how many bytes the moov box will need so the mov muxer can reserve
+ * that space right after ftyp ("moov_size") and write the index there on
+ * av_write_trailer(), instead of appending it and rewriting the whole file
+ * for "faststart". Returns 0 when a packet count can't be guessed for some
+ * stream.
+ */
+static int64_t estimate_moov_size(AVFormatContext *input_format_context, const int *streams_list)
+{
+    int64_t size = MOOV_BYTES_BASE;
+    unsigned int i;
+
+    for (i = 0; i < input_format_context->nb_streams; i++)
+    {
+        AVStream *in_stream = input_format_context->streams[i];
+        AVCodecParameters *in_codecpar = in_stream->codecpar;
+        int64_t duration = in_stream->duration;
+        int64_t packets = in_stream->nb_frames;
+
+        if (streams_list[i] < 0)
+            continue;
+
+        if (duration == AV_NOPTS_VALUE && input_format_context->duration != AV_NOPTS_VALUE)
+            duration = av_rescale_q(input_format_context->duration, AV_TIME_BASE_Q, in_stream->time_base);
+
+        if (packets <= 0 && duration > 0)
+        {
+            if (in_codecpar->codec_type == AVMEDIA_TYPE_VIDEO && in_stream->avg_frame_rate.num > 0)
+                packets = av_rescale_q(duration, in_stream->time_base, av_inv_q(in_stream->avg_frame_rate));
+            else if (in_codecpar->codec_type == AVMEDIA_TYPE_AUDIO && in_codecpar->sample_rate > 0)
+            {
+                int frame_size = in_codecpar->frame_size > 0 ? in_codecpar->frame_size : 1024;
+                packets = av_rescale_q(duration, in_stream->time_base, (AVRational){frame_size, in_codecpar->sample_rate});
+            }
+            else if (in_codecpar->codec_type == AVMEDIA_TYPE_SUBTITLE)
+                packets = av_rescale_q(duration, in_stream->time_base, (AVRational){1, 1});
+        }
+        if (packets <= 0)
+            return 0;
+
+        size += MOOV_BYTES_PER_STREAM + packets * MOOV_BYTES_PER_PACKET;
+    }
+    // duration and frame rate are only hints, keep some headroom
+    size += size / 4;
+    return size > INT_MAX ? 0 : size;
+}
 
 int main(int argc, char **argv)
 {
@@ -24,22 +80,66 @@ int main(int argc, char **argv)
     int *streams_list = NULL;
     int number_of_streams = 0;
     int fragmented_mp4_options = 0;
+    int faststart_options = 0;
+    int64_t moov_size = 0;
+    int moov_too_small = 0;
+    int stream_options = 0;
+    int hls_options = 0;
+    const char *out_format_name = NULL;
     AVDictionary *opts = NULL;
+    AVDictionary *input_opts = NULL;
+    PacketIndex packet_index = { 0 };
+    char *index_filename = NULL;
+    int seek_stream;
+    int64_t seek_timestamp;
 
     if (argc < 3)
     {
         printf("You need to pass at least two parameters.\n");
+        printf("usage: %s <input> <output> [copy|frag|faststart|stream|hls] [start seconds]\n", argv[0]);
+        printf("       use '-' as input to read from stdin, and as output to write to stdout in stream mode\n");
         return -1;
     }
-    else if (argc == 4)
+    else if (argc >= 4)
     {
-        fragmented_mp4_options = 1;
+        if (!strcmp(argv[3], "copy"))
+            ;
+        else if (!strcmp(argv[3], "faststart"))
+            faststart_options = 1;
+        else if (!strcmp(argv[3], "stream"))
+            stream_options = 1;
+        else if (!strcmp(argv[3], "hls"))
+            hls_options = 1;
+        else
+            fragmented_mp4_options = 1;
     }
 
     in_filename = argv[1];
     out_filename = argv[2];
 
-    if ((ret = avformat_open_input(&input_format_context, in_filename, NULL, NULL)) < 0)
+    if (stream_options || hls_options)
+    {
+        // the input may be a pipe, so keep probing short: everything read by
+        // avformat_find_stream_info() stays buffered until the loop below
+        // consumes it
+        if (!strcmp(in_filename, "-"))
+            in_filename = "pipe:0";
+        av_dict_set(&input_opts, "probesize", "1000000", 0);
+        av_dict_set(&input_opts, "analyzeduration", "1000000", 0);
+    }
+    if (stream_options)
+    {
+        // a pipe has no extension to guess the muxer from
+        out_format_name = "mp4";
+        if (!strcmp(out_filename, "-"))
+            out_filename = "pipe:1";
+    }
+    else if (hls_options)
+    {
+        out_format_name = "hls";
+    }
+
+    if ((ret = avformat_open_input(&input_format_context, in_filename, NULL, &input_opts)) < 0)
     {
         fprintf(stderr, "Could not open input file '%s'", in_filename);
         goto end;
@@ -50,7 +150,32 @@ int main(int argc, char **argv)
         goto end;
     }
 
-    avformat_alloc_output_context2(&output_format_context, NULL, NULL, out_filename);
+    if (argc > 4)
+    {
+        // seek on the main stream, through the sidecar index when there is one
+        // (see index_packets) so the demuxer jumps straight to a byte offset
+        seek_stream = av_find_best_stream(input_format_context, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+        if (seek_stream < 0)
+            seek_stream = 0;
+        seek_timestamp = av_rescale_q((int64_t)(atof(argv[4]) * AV_TIME_BASE), AV_TIME_BASE_Q,
+                                      input_format_context->streams[seek_stream]->time_base);
+        if (input_format_context->streams[seek_stream]->start_time != AV_NOPTS_VALUE)
+            seek_timestamp += input_format_context->streams[seek_stream]->start_time;
+
+        index_filename = packet_index_filename(in_filename);
+        if (index_filename && packet_index_load(&packet_index, index_filename) >= 0)
+            ret = packet_index_seek(input_format_context, &packet_index, seek_stream, seek_timestamp);
+        else
+            ret = av_seek_frame(input_format_context, seek_stream, seek_timestamp, AVSEEK_FLAG_BACKWARD);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Could not seek to %s seconds\n", argv[4]);
+            goto end;
+        }
+    }
+
+remux:
+    avformat_alloc_output_context2(&output_format_context, NULL, out_format_name, out_filename);
     if (!output_format_context)
     {
         fprintf(stderr, "Could not create output context\n");
@@ -111,11 +236,53 @@ int main(int argc, char **argv)
         }
     }
 
-    if (fragmented_mp4_options)
+    if (stream_options || hls_options)
+    {
+        // push every packet out as soon as it is muxed and never hold more
+        // than a second of packets for interleaving, so memory use does not
+        // depend on the stream length
+        output_format_context->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+        output_format_context->max_interleave_delta = AV_TIME_BASE;
+    }
+
+    if (stream_options)
+    {
+        // fragments are cut and written out on each keyframe, nothing is
+        // kept around for a final moov
+        av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    }
+    else if (hls_options)
+    {
+        // rolling playlist: segments are cut on keyframes, old ones are
+        // removed from the playlist and from disk
+        av_dict_set(&opts, "hls_time", "4", 0);
+        av_dict_set(&opts, "hls_list_size", "6", 0);
+        av_dict_set(&opts, "hls_flags", "delete_segments+independent_segments", 0);
+    }
+    else if (fragmented_mp4_options)
     {
         // https://developer.mozilla.org/en-US/docs/Web/API/Media_Source_Extensions_API/Transcoding_assets_for_MSE
         av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
     }
+    else if (faststart_options)
+    {
+        // reserve room for moov after ftyp so it is written in place by the
+        // trailer; only fall back to the rewriting faststart pass when the
+        // packet count of some stream is unknown, or the reservation turned
+        // out too small on a first attempt
+        moov_size = moov_too_small ? 0 : estimate_moov_size(input_format_context, streams_list);
+        if (moov_size > 0)
+        {
+            printf("Reserving %" PRId64 " bytes for moov\n", moov_size);
+            av_dict_set_int(&opts, "moov_size", moov_size, 0);
+        }
+        else
+        {
+            if (!moov_too_small)
+                printf("Could not estimate moov size, falling back to faststart rewrite\n");
+            av_dict_set(&opts, "movflags", "faststart", 0);
+        }
+    }
     // https://ffmpeg.org/doxygen/trunk/group__lavf__encoding.html#ga18b7b10bb5b94c4842de18166bc677cb
     ret = avformat_write_header(output_format_context, &opts);
     if (ret < 0)
@@ -154,7 +321,35 @@ int main(int argc, char **argv)
         av_packet_unref(&packet);
     }
     // https://ffmpeg.org/doxygen/trunk/group__lavf__encoding.html#ga7f14007e7dc8f481f054b21614dfec13
-    av_write_trailer(output_format_context);
+    if (av_write_trailer(output_format_context) < 0 && moov_size > 0 && ret == AVERROR_EOF)
+    {
+        // the muxer leaves the file without an index; remux everything again,
+        // this time with the rewriting faststart pass
+        fprintf(stderr, "Reserved moov space of %" PRId64 " bytes was too small, remuxing with faststart\n", moov_size);
+        if (!(output_format_context->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&output_format_context->pb);
+        avformat_free_context(output_format_context);
+        output_format_context = NULL;
+        av_freep(&streams_list);
+        av_dict_free(&opts);
+        stream_index = 0;
+        moov_too_small = 1;
+
+        if (argc > 4 && packet_index.header)
+            ret = packet_index_seek(input_format_context, &packet_index, seek_stream, seek_timestamp);
+        else if (argc > 4)
+            ret = av_seek_frame(input_format_context, seek_stream, seek_timestamp, AVSEEK_FLAG_BACKWARD);
+        else
+            ret = av_seek_frame(input_format_context, -1,
+                                input_format_context->start_time != AV_NOPTS_VALUE ? input_format_context->start_time : 0,
+                                AVSEEK_FLAG_BACKWARD);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Could not rewind the input\n");
+            goto end;
+        }
+        goto remux;
+    }
 
 end:
     avformat_close_input(&input_format_context);
@@ -163,6 +358,10 @@ end:
         avio_closep(&output_format_context->pb);
     avformat_free_context(output_format_context);
     av_freep(&streams_list);
+    av_dict_free(&opts);
+    av_dict_free(&input_opts);
+    packet_index_free(&packet_index);
+    av_free(index_filename);
     if (ret < 0 && ret != AVERROR_EOF)
     {
         fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
@@ -11,48 +11,106 @@ extern "C"
 {
  #include <libavutil/imgutils.h>
  #include <libavutil/parseutils.h>
+ #include <libavutil/time.h>
  #include <libswscale/swscale.h>
 }
- 
-static void fill_yuv_image(uint8_t *data[4], int linesize[4],
-                           int width, int height, int frame_index)
+#include "crop.h"
+#include "parallel_scale.h"
+#include "test_pattern.h"
+
+#define BENCHMARK_FRAMES 20
+
+/*
+ * Time sws_scale() on one thread against parallel_scale() for the
+ * conversions that dominate thumbnail and ladder jobs.
+ */
+static int run_benchmark(int threads)
 {
-    int x, y;
- 
-    /* Y */
-    for (y = 0; y < height; y++)
-        for (x = 0; x < width; x++)
-            data[0][y * linesize[0] + x] = x + y + frame_index * 3;
- 
-    /* Cb and Cr */
-    for (y = 0; y < height / 2; y++) {
-        for (x = 0; x < width / 2; x++) {
-            data[1][y * linesize[1] + x] = 128 + y + frame_index * 2;
-            data[2][y * linesize[2] + x] = 64 + x + frame_index * 5;
+    static const struct { int src_w, src_h, dst_w, dst_h; } cases[] = {
+        { 1920, 1080, 3840, 2160 },
+        { 3840, 2160, 1280, 720 },
+    };
+    const enum AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+
+    for (size_t c = 0; c < FF_ARRAY_ELEMS(cases); c++) {
+        uint8_t *src_data[4] = { NULL }, *dst_data[4] = { NULL };
+        int src_linesize[4], dst_linesize[4];
+        int src_w = cases[c].src_w, src_h = cases[c].src_h, dst_w = cases[c].dst_w, dst_h = cases[c].dst_h;
+        struct SwsContext *sws_ctx = sws_getContext(src_w, src_h, pix_fmt, dst_w, dst_h, pix_fmt,
+                                                    SWS_BICUBIC, NULL, NULL, NULL);
+        ParallelScaler *scaler = parallel_scaler_alloc(src_w, src_h, pix_fmt, dst_w, dst_h, pix_fmt,
+                                                       SWS_BICUBIC, threads);
+        int64_t start, single, parallel;
+        int i, ret = -1;
+
+        if (!sws_ctx || !scaler ||
+            av_image_alloc(src_data, src_linesize, src_w, src_h, pix_fmt, 32) < 0 ||
+            av_image_alloc(dst_data, dst_linesize, dst_w, dst_h, pix_fmt, 32) < 0) {
+            fprintf(stderr, "Could not set up %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
+            goto next;
         }
+        test_pattern_fill(src_data, src_linesize, pix_fmt, src_w, src_h, TEST_PATTERN_ZONEPLATE, 0, 0);
+
+        // one untimed run of each to warm up caches
+        sws_scale(sws_ctx, src_data, src_linesize, 0, src_h, dst_data, dst_linesize);
+        if ((ret = parallel_scale(scaler, src_data, src_linesize, dst_data, dst_linesize)) < 0)
+            goto next;
+
+        start = av_gettime_relative();
+        for (i = 0; i < BENCHMARK_FRAMES; i++)
+            sws_scale(sws_ctx, src_data, src_linesize, 0, src_h, dst_data, dst_linesize);
+        single = av_gettime_relative() - start;
+
+        start = av_gettime_relative();
+        for (i = 0; i < BENCHMARK_FRAMES && ret >= 0; i++)
+            ret = parallel_scale(scaler, src_data, src_linesize, dst_data, dst_linesize);
+        parallel = av_gettime_relative() - start;
+
+        if (ret >= 0)
+            printf("%dx%d -> %dx%d: %.2f ms single threaded, %.2f ms on %d threads, %.2fx\n",
+                   src_w, src_h, dst_w, dst_h, single / 1000.0 / BENCHMARK_FRAMES,
+                   parallel / 1000.0 / BENCHMARK_FRAMES, parallel_scaler_threads(scaler),
+                   (double)single / parallel);
+    next:
+        av_freep(&src_data[0]);
+        av_freep(&dst_data[0]);
+        sws_freeContext(sws_ctx);
+        parallel_scaler_free(&scaler);
+        if (ret < 0)
+            return 1;
     }
+    return 0;
 }
  
 int main(int argc, char **argv)
 {
     QCoreApplication app(argc, argv);
     uint8_t *src_data[4], *dst_data[4];
+    const uint8_t *crop_data[4];
     int src_linesize[4], dst_linesize[4];
     int src_w = 320, src_h = 240, dst_w, dst_h;
+    CropRect crop = { 0, 0, 320, 240 };
     enum AVPixelFormat src_pix_fmt = AV_PIX_FMT_YUV420P, dst_pix_fmt = AV_PIX_FMT_RGB24;
     const char *dst_size = NULL;
     const char *dst_filename = NULL;
     FILE *dst_file;
     int dst_bufsize;
-    struct SwsContext *sws_ctx;
+    ParallelScaler *scaler;
     int i, ret;
  
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s output_file output_size\n"
+    if (argc >= 2 && !strcmp(argv[1], "--benchmark"))
+        return run_benchmark(argc > 2 ? atoi(argv[2]) : 0);
+
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s output_file output_size [x,y,width,height]\n"
+                "       %s --benchmark [threads]\n"
                 "API example program to show how to scale an image with libswscale.\n"
                 "This program generates a series of pictures, rescales them to the given "
                 "output_size and saves them to an output file named output_file\n."
-                "\n", argv[0]);
+                "With a crop rectangle only that region of the pictures is scaled.\n"
+                "The scaling is split across threads; --benchmark compares that with a\n"
+                "single thread.\n"
+                "\n", argv[0], argv[0]);
         exit(1);
     }
     dst_filename = argv[1];
@@ -65,21 +123,27 @@ int main(int argc, char **argv)
         exit(1);
     }
  
+    // the source is cropped by offsetting its plane pointers, the scaler
+    // only ever sees the rectangle
+    if (argc == 4 && (crop_parse(&crop, argv[3]) < 0 ||
+                      crop_align(&crop, src_pix_fmt, src_w, src_h) < 0))
+        exit(1);
+
     dst_file = fopen(dst_filename, "wb");
     if (!dst_file) {
         fprintf(stderr, "Could not open destination file %s\n", dst_filename);
         exit(1);
     }
  
-    /* create scaling context */
-    sws_ctx = sws_getContext(src_w, src_h, src_pix_fmt,
-                             dst_w, dst_h, dst_pix_fmt,
-                             SWS_BILINEAR, NULL, NULL, NULL);
-    if (!sws_ctx) {
+    /* create scaling contexts, one per band of the output */
+    scaler = parallel_scaler_alloc(crop.width, crop.height, src_pix_fmt,
+                                   dst_w, dst_h, dst_pix_fmt,
+                                   SWS_BILINEAR, 0);
+    if (!scaler) {
         fprintf(stderr,
                 "Impossible to create scale context for the conversion "
                 "fmt:%s s:%dx%d -> fmt:%s s:%dx%d\n",
-                av_get_pix_fmt_name(src_pix_fmt), src_w, src_h,
+                av_get_pix_fmt_name(src_pix_fmt), crop.width, crop.height,
                 av_get_pix_fmt_name(dst_pix_fmt), dst_w, dst_h);
         ret = AVERROR(EINVAL);
         goto end;
@@ -99,14 +163,17 @@ int main(int argc, char **argv)
         goto end;
     }
     dst_bufsize = ret;
+    crop_planes(&crop, src_pix_fmt, src_data, src_linesize, crop_data);
  
     for (i = 0; i < 100; i++) {
         /* generate synthetic video */
-        fill_yuv_image(src_data, src_linesize, src_w, src_h, i);
+        test_pattern_fill(src_data, src_linesize, src_pix_fmt, src_w, src_h, TEST_PATTERN_GRADIENT, i, 0);
  
         /* convert to destination format */
-        sws_scale(sws_ctx, (const uint8_t * const*)src_data,
-                  src_linesize, 0, src_h, dst_data, dst_linesize);
+        if ((ret = parallel_scale(scaler, crop_data, src_linesize, dst_data, dst_linesize)) < 0) {
+            fprintf(stderr, "Scaling failed\n");
+            goto end;
+        }
  
         /* write scaled image to file */
         fwrite(dst_data[0], 1, dst_bufsize, dst_file);
@@ -120,6 +187,6 @@ end:
     fclose(dst_file);
     av_freep(&src_data[0]);
     av_freep(&dst_data[0]);
-    sws_freeContext(sws_ctx);
+    parallel_scaler_free(&scaler);
     return ret < 0;
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+extern "C"
+{
+    #include <libavutil/frame.h>
+}
+
+/**
+ * Fixed capacity FIFO between the decoding thread and the workers. push()
+ * blocks while the queue is full, so the decoder never runs more than
+ * capacity frames ahead; pop() returns false once the queue is closed and
+ * drained.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+            return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_, not_full_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+/** A decoded frame handed to a worker, with its number in the output. */
+struct FrameJob {
+    AVFrame *frame = NULL;
+    int64_t index = 0;
+};
+
+/**
+ * Pictures allocated once up front and recycled, instead of an
+ * av_image_alloc()/av_freep() pair per frame. They are refcounted AVFrames
+ * so encoders can reference them without a copy.
+ */
+class ImagePool {
+public:
+    ImagePool(int count, int width, int height, enum AVPixelFormat pix_fmt)
+        : requested_(count)
+    {
+        for (int i = 0; i < count; i++) {
+            AVFrame *image = av_frame_alloc();
+            if (!image)
+                break;
+            image->format = pix_fmt;
+            image->width = width;
+            image->height = height;
+            if (av_frame_get_buffer(image, 0) < 0) {
+                av_frame_free(&image);
+                break;
+            }
+            all_.push_back(image);
+            free_.push_back(image);
+        }
+    }
+
+    ~ImagePool()
+    {
+        for (AVFrame *image : all_)
+            av_frame_free(&image);
+    }
+
+    ImagePool(const ImagePool &) = delete;
+    ImagePool &operator=(const ImagePool &) = delete;
+
+    /** false if some picture could not be allocated */
+    bool valid() const { return all_.size() == requested_; }
+
+    AVFrame *acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        available_.wait(lock, [this] { return !free_.empty(); });
+        AVFrame *image = free_.back();
+        free_.pop_back();
+        return image;
+    }
+
+    void release(AVFrame *image)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(image);
+        available_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<AVFrame *> all_, free_;
+    size_t requested_;
+};
+
+#endif /* FRAME_QUEUE_H */
@@ -1,50 +1,485 @@
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QDebug>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 extern "C"
 {
-    #include <libavutil/adler32.h>
+    #include <libavutil/dict.h>
     #include <libavutil/mem.h>
     #include <libavcodec/avcodec.h>
     #include <libavformat/avformat.h>
-    #include <libavutil/imgutils.h>
-    #include <libavutil/timestamp.h>
     #include <libswscale/swscale.h>
 }
+#include "crop.h"
+#include "fingerprint.h"
+#include "fingerprint_index.h"
+#include "packet_index.h"
+#include "frame_queue.h"
+#include "normalize.h"
+#include "raw_store.h"
 
-static void ppm_save(uint8_t *buf[], int byte_size, int wrap, int width, int height, int iFrame, const char* output_filename)
+namespace fs = std::filesystem;
+
+/* Image file formats frames can be written as. */
+struct ImageFormat {
+    const char *name;
+    const char *extension;
+    enum AVCodecID codec_id; ///< AV_CODEC_ID_NONE: written as raw PPM
+    enum AVPixelFormat pix_fmt; ///< what frames are converted to for the encoder
+};
+
+static const ImageFormat image_formats[] = {
+    { "ppm",  "ppm",  AV_CODEC_ID_NONE,  AV_PIX_FMT_RGB24 },
+    { "png",  "png",  AV_CODEC_ID_PNG,   AV_PIX_FMT_RGB24 },
+    { "jpeg", "jpg",  AV_CODEC_ID_MJPEG, AV_PIX_FMT_YUVJ420P },
+    { "webp", "webp", AV_CODEC_ID_WEBP,  AV_PIX_FMT_YUV420P },
+};
+
+static const ImageFormat *find_image_format(const char *name)
+{
+    for (const ImageFormat &format : image_formats) {
+        if (!strcmp(name, format.name) || !strcmp(name, format.extension))
+            return &format;
+    }
+    if (!strcmp(name, "jpg"))
+        return find_image_format("jpeg");
+    return NULL;
+}
+
+struct ExtractOptions {
+    double start_time = -1; ///< seconds, negative to start from the beginning
+    int threads = 0; ///< conversion/writer workers, 0 for one per core
+    bool keyframes_only = false; ///< decode and extract keyframes only
+    double interval = 0; ///< seconds between extracted frames, 0 for all frames
+    const ImageFormat *format = NULL; ///< NULL to pick it from the output name
+    int quality = -1; ///< 1-100 for jpeg/webp, zlib level 0-9 for png, -1 for the encoder default
+    int tensor_width = 0, tensor_height = 0; ///< float NCHW tensor output size, 0 for images
+    float mean[3] = { 0.485f, 0.456f, 0.406f }; ///< per RGB channel, ImageNet defaults
+    float std[3] = { 0.229f, 0.224f, 0.225f };
+    int batch = 0; ///< tensors per batch, 0 for a flat (frames, 3, h, w) array
+    int preview_width = 0; ///< downscale to this width, decoding at reduced resolution if possible
+    bool crop = false;
+    CropRect crop_rect; ///< region to extract, in full resolution picture coordinates
+};
+
+/* State shared by the conversion/writer workers. */
+struct ExtractContext {
+    std::string output_pattern; ///< printf pattern taking the frame number
+    const ImageFormat *format;
+    int quality;
+    int width, height; ///< output picture size
+    int sws_flags;
+    bool crop;
+    CropRect crop_rect; ///< in decoded picture coordinates
+    BoundedQueue<FrameJob> *queue;
+    ImagePool *image_pool;
+    RawFrameStore *raw_store = NULL; ///< set when writing every frame to one .npy file
+    bool tensor = false; ///< raw store holds normalized float32 planes instead of RGB24
+    ChannelNorm norm[3]; ///< R, G, B
+    bool fingerprint = false; ///< hash frames into a fingerprint index instead of writing them
+    AVRational time_base;
+    int64_t start_pts;
+    std::mutex fingerprints_mutex;
+    std::vector<FingerprintEntry> fingerprints;
+    std::atomic<int> error{0};
+};
+
+static bool is_fingerprint_output(const char *output_filename)
+{
+    const char *extension = strrchr(output_filename, '.');
+    return extension && !strcmp(extension, FINGERPRINT_INDEX_EXTENSION);
+}
+
+/*
+ * The output name is either a pattern with the frame number, like
+ * "thumbs/%05d.jpg", or a directory the frames are written to as %08d.<ext>.
+ * A .npy name stores all frames in one raw array instead, see RawFrameStore,
+ * and a .fpidx name their perceptual hashes, see fingerprint_index.h.
+ */
+static int setup_output(ExtractContext *ec, const char *output_filename, const ExtractOptions &options)
+{
+    char probe[1024];
+    const char *extension = strrchr(output_filename, '.');
+
+    if (extension && !strcmp(extension, ".npy")) {
+        // raw RGB frames or tensors, no encoder
+        ec->format = &image_formats[0];
+    } else if (is_fingerprint_output(output_filename)) {
+        ec->format = &image_formats[0];
+        ec->fingerprint = true;
+    } else if (options.tensor_width > 0) {
+        av_log(NULL, AV_LOG_ERROR, "Tensors can only be written to a .npy file\n");
+        return AVERROR(EINVAL);
+    } else if (strchr(output_filename, '%')) {
+        if (av_get_frame_filename(probe, sizeof(probe), output_filename, 1) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Invalid output pattern %s\n", output_filename);
+            return AVERROR(EINVAL);
+        }
+        ec->output_pattern = output_filename;
+        ec->format = options.format;
+        if (!ec->format)
+            ec->format = extension ? find_image_format(extension + 1) : NULL;
+    } else {
+        std::error_code error;
+        fs::create_directories(output_filename, error);
+        ec->format = options.format;
+        if (!ec->format)
+            ec->format = &image_formats[0];
+        ec->output_pattern = std::string(output_filename) + "/%08d." + ec->format->extension;
+    }
+    if (!ec->format) {
+        av_log(NULL, AV_LOG_ERROR, "Can't guess the image format of %s\n", output_filename);
+        return AVERROR(EINVAL);
+    }
+    ec->quality = options.quality;
+    return 0;
+}
+
+static void ppm_save(const AVFrame *image, const char *filename)
 {
     FILE *f;
-    char filename[32];
     int  i;
 
-    sprintf(filename, "./images/%08d.ppm", iFrame);
-    // sprintf(filename, "%s-%d.raw", output_filename, iFrame);
     f = fopen(filename, "wb");
     if(f==NULL)
         return;
-    fprintf(f, "P6\n%d %d\n255\n", width, height);
-    fwrite(buf[0], 1, byte_size, f);
+    fprintf(f, "P6\n%d %d\n255\n", image->width, image->height);
+    for (i = 0; i < image->height; i++)
+        fwrite(image->data[0] + i * image->linesize[0], 1, image->width * 3, f);
 
     fclose(f);
 }
 
-static int video_decode_example(const char *input_filename, const char *output_filename)
+static AVCodecContext *open_image_encoder(const ExtractContext *ec)
+{
+    const AVCodec *codec = avcodec_find_encoder(ec->format->codec_id);
+    AVCodecContext *enc = NULL;
+    AVDictionary *opts = NULL;
+
+    if (!codec) {
+        av_log(NULL, AV_LOG_ERROR, "Can't find %s encoder\n", ec->format->name);
+        return NULL;
+    }
+    enc = avcodec_alloc_context3(codec);
+    if (!enc)
+        return NULL;
+    enc->width = ec->width;
+    enc->height = ec->height;
+    enc->pix_fmt = ec->format->pix_fmt;
+    enc->time_base = (AVRational){1, 25};
+    // frames are already spread across workers, one thread per encoder
+    enc->thread_count = 1;
+
+    if (ec->quality >= 0) {
+        switch (ec->format->codec_id) {
+        case AV_CODEC_ID_MJPEG:
+            // map 1-100 onto the 31 (worst) to 2 (best) qscale range
+            enc->flags |= AV_CODEC_FLAG_QSCALE;
+            enc->global_quality = FF_QP2LAMBDA * (31 - (FFMIN(FFMAX(ec->quality, 1), 100) - 1) * 29 / 99);
+            break;
+        case AV_CODEC_ID_WEBP:
+            av_dict_set_int(&opts, "quality", ec->quality, 0);
+            break;
+        case AV_CODEC_ID_PNG:
+            enc->compression_level = FFMIN(ec->quality, 9);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (avcodec_open2(enc, codec, &opts) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open %s encoder\n", ec->format->name);
+        avcodec_free_context(&enc);
+    }
+    av_dict_free(&opts);
+    return enc;
+}
+
+static int encode_image(AVCodecContext *enc, AVPacket *pkt, AVFrame *image, const char *filename)
+{
+    FILE *f;
+    int ret;
+
+    image->pts = 0;
+    image->quality = enc->global_quality;
+    ret = avcodec_send_frame(enc, image);
+    if (ret < 0)
+        return ret;
+    ret = avcodec_receive_packet(enc, pkt);
+    if (ret < 0)
+        return ret;
+
+    f = fopen(filename, "wb");
+    if (f == NULL) {
+        av_packet_unref(pkt);
+        return AVERROR(errno);
+    }
+    fwrite(pkt->data, 1, pkt->size, f);
+    fclose(f);
+    av_packet_unref(pkt);
+    return 0;
+}
+
+/*
+ * Tensor mode: resize and convert to planar GBR in one sws_scale() into
+ * scratch, then normalize each plane into the RGB-ordered float planes of the
+ * frame's slot in the store.
+ */
+static void write_tensor(const ExtractContext *ec, AVFrame *scratch, float *dst)
+{
+    // GBRP plane order is G, B, R
+    static const int planes[3] = { 2, 0, 1 };
+    size_t plane_size = (size_t)ec->width * ec->height;
+
+    for (int c = 0; c < 3; c++)
+        normalize_plane(dst + c * plane_size, scratch->data[planes[c]], scratch->linesize[planes[c]],
+                        ec->width, ec->height, ec->norm[c]);
+}
+
+/* Fingerprint mode: scratch holds the FINGERPRINT_SIZE^2 luma thumbnail. */
+static void add_fingerprint(ExtractContext *ec, const AVFrame *fr, const AVFrame *scratch)
+{
+    FingerprintEntry entry;
+    int64_t pts = fr->best_effort_timestamp != AV_NOPTS_VALUE ? fr->best_effort_timestamp : fr->pts;
+
+    entry.pts_ms = pts != AV_NOPTS_VALUE ? av_rescale_q(pts - ec->start_pts, ec->time_base, (AVRational){1, 1000}) : 0;
+    entry.phash = fingerprint_phash(scratch->data[0], scratch->linesize[0]);
+    entry.ahash = fingerprint_ahash(scratch->data[0], scratch->linesize[0]);
+
+    std::lock_guard<std::mutex> lock(ec->fingerprints_mutex);
+    ec->fingerprints.push_back(entry);
+}
+
+/*
+ * Worker: convert decoded frames into a pooled picture, then encode and write
+ * it. Each worker keeps its own SwsContext and encoder, neither is shareable
+ * across threads, so images are encoded in parallel.
+ */
+static void convert_worker(ExtractContext *ec)
+{
+    struct SwsContext *img_convert_ctx = NULL;
+    AVCodecContext *enc = NULL;
+    AVFrame *scratch = NULL;
+    enum AVPixelFormat dst_format = ec->tensor ? AV_PIX_FMT_GBRP :
+                                    ec->fingerprint ? AV_PIX_FMT_GRAY8 : ec->format->pix_fmt;
+    AVPacket *pkt = av_packet_alloc();
+    char filename[1024];
+    FrameJob job;
+    int ret;
+
+    if (!pkt) {
+        ec->error = AVERROR(ENOMEM);
+        ec->queue->close();
+        return;
+    }
+    if (!ec->raw_store && !ec->fingerprint && ec->format->codec_id != AV_CODEC_ID_NONE && !(enc = open_image_encoder(ec))) {
+        ec->error = AVERROR(EINVAL);
+        ec->queue->close();
+        av_packet_free(&pkt);
+        return;
+    }
+    if (ec->tensor || ec->fingerprint) {
+        scratch = av_frame_alloc();
+        if (scratch) {
+            scratch->format = dst_format;
+            scratch->width = ec->width;
+            scratch->height = ec->height;
+        }
+        if (!scratch || av_frame_get_buffer(scratch, 0) < 0) {
+            ec->error = AVERROR(ENOMEM);
+            ec->queue->close();
+            av_frame_free(&scratch);
+            av_packet_free(&pkt);
+            return;
+        }
+    }
+
+    while (ec->queue->pop(job)) {
+        AVFrame *fr = job.frame;
+        const uint8_t *src[4] = { fr->data[0], fr->data[1], fr->data[2], fr->data[3] };
+        int src_w = fr->width, src_h = fr->height;
+
+        if (ec->crop) {
+            // only the rows and columns of the region are handed to swscale
+            CropRect rect = ec->crop_rect;
+            if (crop_align(&rect, (enum AVPixelFormat)fr->format, fr->width, fr->height) < 0) {
+                ec->error = AVERROR(EINVAL);
+                av_frame_free(&job.frame);
+                continue;
+            }
+            crop_planes(&rect, (enum AVPixelFormat)fr->format, fr->data, fr->linesize, src);
+            src_w = rect.width;
+            src_h = rect.height;
+        }
+
+        img_convert_ctx = sws_getCachedContext(img_convert_ctx, src_w, src_h, (enum AVPixelFormat)fr->format,
+                                               ec->width, ec->height, dst_format, ec->sws_flags,
+                                               NULL, NULL, NULL);
+        if (img_convert_ctx == NULL) {
+            fprintf(stderr, "Cannot initialize the conversion context!\n");
+            ec->error = AVERROR(EINVAL);
+            av_frame_free(&job.frame);
+            continue;
+        }
+
+        if (ec->fingerprint) {
+            sws_scale(img_convert_ctx, src, fr->linesize, 0, src_h, scratch->data, scratch->linesize);
+            add_fingerprint(ec, fr, scratch);
+            av_frame_free(&job.frame);
+            continue;
+        }
+
+        if (ec->raw_store) {
+            // convert straight into the frame's slot of the mapped file
+            uint8_t *dst = ec->raw_store->begin_frame(job.index - 1);
+            if (dst && ec->tensor) {
+                sws_scale(img_convert_ctx, src, fr->linesize, 0, src_h, scratch->data, scratch->linesize);
+                write_tensor(ec, scratch, (float *)dst);
+                ec->raw_store->end_frame();
+            } else if (dst) {
+                int dst_linesize = ec->width * 3;
+                sws_scale(img_convert_ctx, src, fr->linesize, 0, src_h, &dst, &dst_linesize);
+                ec->raw_store->end_frame();
+            } else {
+                ec->error = AVERROR(ENOMEM);
+            }
+            av_frame_free(&job.frame);
+            continue;
+        }
+
+        AVFrame *image = ec->image_pool->acquire();
+        // an encoder may still hold a reference from the last use
+        ret = av_frame_make_writable(image);
+        if (ret >= 0) {
+            sws_scale(img_convert_ctx, src, fr->linesize, 0, src_h, image->data, image->linesize);
+            av_get_frame_filename(filename, sizeof(filename), ec->output_pattern.c_str(), job.index);
+            if (enc)
+                ret = encode_image(enc, pkt, image, filename);
+            else
+                ppm_save(image, filename);
+        }
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Can't write %s\n", filename);
+            ec->error = ret;
+        }
+        ec->image_pool->release(image);
+        av_frame_free(&job.frame);
+    }
+    sws_freeContext(img_convert_ctx);
+    av_frame_free(&scratch);
+    avcodec_free_context(&enc);
+    av_packet_free(&pkt);
+}
+
+/*
+ * Number of frames the raw store is preallocated for. It is only a hint, the
+ * store grows if the stream holds more.
+ */
+static int64_t estimate_frame_count(const AVFormatContext *fmt_ctx, const AVStream *st, const ExtractOptions &options)
+{
+    double duration = 0;
+    int64_t frames;
+
+    if (st->duration != AV_NOPTS_VALUE)
+        duration = st->duration * av_q2d(st->time_base);
+    else if (fmt_ctx->duration != AV_NOPTS_VALUE)
+        duration = fmt_ctx->duration / (double)AV_TIME_BASE;
+    if (options.start_time > 0)
+        duration = FFMAX(duration - options.start_time, 0);
+
+    if (options.interval > 0)
+        frames = (int64_t)(duration / options.interval) + 1;
+    else if (st->nb_frames > 0 && options.start_time <= 0)
+        frames = st->nb_frames;
+    else if (st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0)
+        frames = (int64_t)(duration * av_q2d(st->avg_frame_rate)) + 1;
+    else
+        frames = 0;
+    return FFMAX(frames, 16);
+}
+
+static int64_t seconds_to_timestamp(const AVStream *st, double seconds)
+{
+    int64_t timestamp = av_rescale_q((int64_t)(seconds * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+    if (st->start_time != AV_NOPTS_VALUE)
+        timestamp += st->start_time;
+    return timestamp;
+}
+
+/*
+ * Jump to the keyframe before timestamp (in the stream time base), straight
+ * to its byte offset when a sidecar packet index (see index_packets) exists
+ * for the input.
+ */
+static int seek_to_timestamp(AVFormatContext *fmt_ctx, const PacketIndex *index, int video_stream, int64_t timestamp)
+{
+    if (index->header)
+        return packet_index_seek(fmt_ctx, index, video_stream, timestamp);
+    return av_seek_frame(fmt_ctx, video_stream, timestamp, AVSEEK_FLAG_BACKWARD);
+}
+
+/*
+ * Return the next decoded frame of the video stream in fr, reading and
+ * sending packets as the decoder asks for them. Returns AVERROR_EOF once the
+ * decoder is drained.
+ */
+static int decode_next_frame(AVFormatContext *fmt_ctx, AVCodecContext *ctx, AVPacket *pkt,
+                             int video_stream, AVFrame *fr, bool keyframes_only)
+{
+    int result;
+
+    while (1) {
+        result = avcodec_receive_frame(ctx, fr);
+        if (result != AVERROR(EAGAIN)) {
+            if (result < 0 && result != AVERROR_EOF)
+                av_log(NULL, AV_LOG_ERROR, "Error decoding frame\n");
+            return result;
+        }
+
+        // with skip_frame = AVDISCARD_NONKEY the decoder would drop the other
+        // packets anyway, don't even hand them over
+        while ((result = av_read_frame(fmt_ctx, pkt)) >= 0 &&
+               (pkt->stream_index != video_stream || (keyframes_only && !(pkt->flags & AV_PKT_FLAG_KEY))))
+            av_packet_unref(pkt);
+
+        if (result < 0)
+            result = avcodec_send_packet(ctx, NULL);
+        else
+            result = avcodec_send_packet(ctx, pkt);
+        av_packet_unref(pkt);
+
+        if (result < 0 && result != AVERROR_EOF) {
+            av_log(NULL, AV_LOG_ERROR, "Error submitting a packet for decoding\n");
+            return result;
+        }
+    }
+}
+
+static int video_decode_example(const char *input_filename, const char *output_filename, const ExtractOptions &options)
 {
     const AVCodec *codec = NULL;
     AVCodecContext *ctx= NULL;
     AVCodecParameters *origin_par = NULL;
     AVFrame *fr = NULL;
-    uint8_t *byte_buffer = NULL;
     AVPacket *pkt;
     AVFormatContext *fmt_ctx = NULL;
-    int number_of_written_bytes;
     int video_stream;
-    int byte_buffer_size;
-    int i = 0;
     int result;
-    int num_bytes;
-    uint8_t *buffer[4];
-    int dst_linesize[4];
+    int64_t frame_index = 0;
+    int target_width, target_height = 0, source_width, source_height;
+    int64_t target = AV_NOPTS_VALUE, interval = 0, last_pts = AV_NOPTS_VALUE, end_pts = AV_NOPTS_VALUE;
+    AVStream *st;
+    PacketIndex packet_index = {};
+    char *index_filename;
+    ExtractContext ec;
+    std::vector<std::thread> workers;
+    int threads = options.threads > 0 ? options.threads : av_cpu_count();
 
     result = avformat_open_input(&fmt_ctx, input_filename, NULL, NULL);
     if (result < 0) {
@@ -84,6 +519,30 @@ static int video_decode_example(const char *input_filename, const char *output_f
         return result;
     }
 
+    // for small outputs let the decoder skip the high frequencies: lowres n
+    // decodes at 1/2^n of the size, as far as the output stays at least as
+    // large in both dimensions
+    source_width = options.crop ? options.crop_rect.width : origin_par->width;
+    source_height = options.crop ? options.crop_rect.height : origin_par->height;
+    if (is_fingerprint_output(output_filename)) {
+        target_width = target_height = FINGERPRINT_SIZE;
+    } else if (options.tensor_width > 0) {
+        target_width = options.tensor_width;
+        target_height = options.tensor_height;
+    } else {
+        target_width = options.preview_width;
+        if (target_width > 0 && source_width > 0)
+            target_height = FFMAX(av_rescale(target_width, source_height, source_width), 1);
+    }
+    if (target_width > 0 && target_height > 0) {
+        while (ctx->lowres < codec->max_lowres &&
+               (source_width >> (ctx->lowres + 1)) >= target_width &&
+               (source_height >> (ctx->lowres + 1)) >= target_height)
+            ctx->lowres++;
+        if (ctx->lowres)
+            qDebug() << "decoding at 1 /" << (1 << ctx->lowres) << "resolution";
+    }
+
     result = avcodec_open2(ctx, codec, NULL);
     if (result < 0) {
         av_log(ctx, AV_LOG_ERROR, "Can't open decoder\n");
@@ -102,109 +561,277 @@ static int video_decode_example(const char *input_filename, const char *output_f
         return AVERROR(ENOMEM);
     }
 
-    byte_buffer_size = av_image_get_buffer_size(ctx->pix_fmt, ctx->width, ctx->height, 16);
-    byte_buffer = (uint8_t *)av_malloc(byte_buffer_size);
-    if (!byte_buffer) {
-        av_log(NULL, AV_LOG_ERROR, "Can't allocate buffer\n");
-        return AVERROR(ENOMEM);
-    }
+    if (options.keyframes_only)
+        ctx->skip_frame = AVDISCARD_NONKEY;
 
-    qDebug() << "#tb "<< video_stream << ":" << fmt_ctx->streams[video_stream]->time_base.num << "/" << fmt_ctx->streams[video_stream]->time_base.den;
+    st = fmt_ctx->streams[video_stream];
+    index_filename = packet_index_filename(input_filename);
+    if (index_filename)
+        packet_index_load(&packet_index, index_filename);
+    av_free(index_filename);
 
-    result = 0;
-    while (result >= 0) {
-        result = av_read_frame(fmt_ctx, pkt);
-        if (result >= 0 && pkt->stream_index != video_stream) {
-            av_packet_unref(pkt);
-            continue;
+    if (options.interval > 0) {
+        // seek to every target time instead of decoding what lies between
+        interval = av_rescale_q((int64_t)(options.interval * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+        target = seconds_to_timestamp(st, options.start_time >= 0 ? options.start_time : 0);
+        if (st->duration != AV_NOPTS_VALUE)
+            end_pts = (st->start_time != AV_NOPTS_VALUE ? st->start_time : 0) + st->duration;
+        else if (fmt_ctx->duration != AV_NOPTS_VALUE)
+            end_pts = seconds_to_timestamp(st, fmt_ctx->duration / (double)AV_TIME_BASE);
+    } else if (options.start_time >= 0) {
+        result = seek_to_timestamp(fmt_ctx, &packet_index, video_stream, seconds_to_timestamp(st, options.start_time));
+        if (result < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Can't seek to %f\n", options.start_time);
+            packet_index_free(&packet_index);
+            return result;
         }
+    }
 
-        if (result < 0)
-            result = avcodec_send_packet(ctx, NULL);
-        else {
-            if (pkt->pts == AV_NOPTS_VALUE)
-                pkt->pts = pkt->dts = i;
-            result = avcodec_send_packet(ctx, pkt);
+    qDebug() << "#tb "<< video_stream << ":" << fmt_ctx->streams[video_stream]->time_base.num << "/" << fmt_ctx->streams[video_stream]->time_base.den;
+
+    // decode here, convert and write on a pool of workers; the queue holds
+    // frame references only and bounds how far decoding runs ahead
+    BoundedQueue<FrameJob> queue(threads * 2);
+    result = setup_output(&ec, output_filename, options);
+    if (result < 0) {
+        packet_index_free(&packet_index);
+        return result;
+    }
+    ec.crop = options.crop;
+    if (options.crop) {
+        // decoded pictures are 1/2^lowres of the full resolution
+        ec.crop_rect.x = options.crop_rect.x >> ctx->lowres;
+        ec.crop_rect.y = options.crop_rect.y >> ctx->lowres;
+        ec.crop_rect.width = FFMAX(options.crop_rect.width >> ctx->lowres, 1);
+        ec.crop_rect.height = FFMAX(options.crop_rect.height >> ctx->lowres, 1);
+        source_width = options.crop_rect.width;
+        source_height = options.crop_rect.height;
+        if (options.crop_rect.x + source_width > origin_par->width ||
+            options.crop_rect.y + source_height > origin_par->height) {
+            av_log(NULL, AV_LOG_ERROR, "Crop is outside the %dx%d picture\n", origin_par->width, origin_par->height);
+            packet_index_free(&packet_index);
+            return AVERROR(EINVAL);
         }
-        av_packet_unref(pkt);
+    } else {
+        source_width = origin_par->width;
+        source_height = origin_par->height;
+    }
 
+    // the downscale happens in the same sws_scale() as the pixel format
+    // conversion, sized from the full resolution picture
+    if (options.preview_width > 0) {
+        ec.width = options.preview_width;
+        ec.height = FFMAX(av_rescale(options.preview_width, source_height, source_width), 1);
+        ec.sws_flags = SWS_AREA;
+    } else {
+        ec.width = source_width;
+        ec.height = source_height;
+        ec.sws_flags = SWS_BICUBIC;
+    }
+    RawFrameStore raw_store;
+    if (ec.fingerprint) {
+        // hashes are taken from a square luma thumbnail, whatever the aspect
+        ec.width = ec.height = FINGERPRINT_SIZE;
+        ec.sws_flags = SWS_AREA;
+        ec.time_base = st->time_base;
+        ec.start_pts = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    } else if (ec.output_pattern.empty() && options.tensor_width > 0) {
+        ec.tensor = true;
+        ec.width = options.tensor_width;
+        ec.height = options.tensor_height;
+        for (int c = 0; c < 3; c++)
+            ec.norm[c] = channel_norm(options.mean[c], options.std[c]);
+        result = raw_store.open(output_filename, "<f4", { 3, ec.height, ec.width }, sizeof(float),
+                                estimate_frame_count(fmt_ctx, st, options), options.batch);
+    } else if (ec.output_pattern.empty()) {
+        result = raw_store.open(output_filename, "|u1", { ec.height, ec.width, 3 }, 1,
+                                estimate_frame_count(fmt_ctx, st, options));
+    }
+    if (ec.output_pattern.empty() && !ec.fingerprint) {
         if (result < 0) {
-            av_log(NULL, AV_LOG_ERROR, "Error submitting a packet for decoding\n");
+            packet_index_free(&packet_index);
             return result;
         }
+        ec.raw_store = &raw_store;
+    }
+    ImagePool image_pool(ec.raw_store || ec.fingerprint ? 0 : threads, ec.width, ec.height, ec.format->pix_fmt);
+    if (!image_pool.valid()) {
+        av_log(NULL, AV_LOG_ERROR, "Can't allocate buffer\n");
+        packet_index_free(&packet_index);
+        return AVERROR(ENOMEM);
+    }
+    ec.queue = &queue;
+    ec.image_pool = &image_pool;
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back(convert_worker, &ec);
 
-        while (result >= 0) {
-            result = avcodec_receive_frame(ctx, fr);
-            if (result == AVERROR_EOF)
-                goto finish;
-            else if (result == AVERROR(EAGAIN)) {
-                result = 0;
+    while (1) {
+        if (interval) {
+            if (end_pts != AV_NOPTS_VALUE && target >= end_pts)
                 break;
-            } else if (result < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Error decoding frame\n");
-                return result;
+            // a frame at or past the target may already have been decoded
+            // when the interval is shorter than a frame
+            if (last_pts == AV_NOPTS_VALUE || target > last_pts) {
+                if (seek_to_timestamp(fmt_ctx, &packet_index, video_stream, target) < 0)
+                    break;
+                avcodec_flush_buffers(ctx);
             }
-
-            number_of_written_bytes = av_image_copy_to_buffer(byte_buffer, byte_buffer_size,
-                                    (const uint8_t* const *)fr->data, (const int*) fr->linesize,
-                                    ctx->pix_fmt, ctx->width, ctx->height, 1);
-            if (number_of_written_bytes < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Can't copy image to buffer\n");
+            // decode forward from the keyframe to the first frame at the target
+            while ((result = decode_next_frame(fmt_ctx, ctx, pkt, video_stream, fr, options.keyframes_only)) >= 0) {
+                last_pts = fr->best_effort_timestamp;
+                if (last_pts == AV_NOPTS_VALUE || last_pts >= target)
+                    break;
                 av_frame_unref(fr);
-                return number_of_written_bytes;
-            }
-            qDebug() << video_stream << ctx->frame_num << av_ts2str(fr->pts) << av_ts2str(fr->pkt_dts) << number_of_written_bytes << av_adler32_update(0, (const uint8_t*)byte_buffer, number_of_written_bytes) << fr->format;
-
-            num_bytes = av_image_alloc(buffer, dst_linesize, ctx->width, ctx->height, AV_PIX_FMT_RGB24, 1);
-            if (num_bytes < 0) {
-                av_log(NULL, AV_LOG_ERROR, "Can't allocate buffer\n");
-                return AVERROR(ENOMEM);
             }
+            if (result < 0)
+                goto finish;
+            do
+                target += interval;
+            while (last_pts != AV_NOPTS_VALUE && target <= last_pts);
+        } else {
+            result = decode_next_frame(fmt_ctx, ctx, pkt, video_stream, fr, options.keyframes_only);
+            if (result < 0)
+                goto finish;
+        }
 
-            static struct SwsContext *img_convert_ctx;
-            if(img_convert_ctx == NULL) {
-                int w = ctx->width;
-                int h = ctx->height;
-                
-                img_convert_ctx = sws_getContext(w, h, 
-                                ctx->pix_fmt, 
-                                w, h, AV_PIX_FMT_RGB24, SWS_BICUBIC,
-                                NULL, NULL, NULL);
-                if(img_convert_ctx == NULL) {
-                    fprintf(stderr, "Cannot initialize the conversion context!\n");
-                    exit(1);
-                }
-            }
-            int ret = sws_scale(img_convert_ctx, (const uint8_t * const*)fr->data, fr->linesize, 0, 
-                        ctx->height, buffer, dst_linesize);
-            
-            qDebug() << "[frame] width: " << ctx->width << "height: " << ctx->height << "linesize: " << fr->linesize[0];
-            qDebug() << "[image] num_bytes: " << num_bytes << "linesize: " << dst_linesize;
-            ppm_save(buffer, num_bytes, dst_linesize[0], ctx->width, ctx->height, ctx->frame_num, output_filename);
+        FrameJob job;
+        job.frame = av_frame_alloc();
+        if (!job.frame) {
             av_frame_unref(fr);
-            av_freep(&buffer);
+            result = AVERROR(ENOMEM);
+            goto finish;
+        }
+        job.index = ++frame_index;
+        av_frame_move_ref(job.frame, fr);
+        if (!queue.push(job)) {
+            // every worker gave up, ec.error tells why
+            av_frame_free(&job.frame);
+            result = 0;
+            goto finish;
         }
     }
+    result = 0;
 
 finish:
+    queue.close();
+    for (auto &worker : workers)
+        worker.join();
     av_packet_free(&pkt);
     av_frame_free(&fr);
     avformat_close_input(&fmt_ctx);
     avcodec_free_context(&ctx);
-    av_freep(&byte_buffer);
-    return 0;
+    packet_index_free(&packet_index);
+    if (ec.raw_store && raw_store.close() < 0 && !ec.error)
+        ec.error = AVERROR(EIO);
+    if (ec.fingerprint && !ec.error && (result >= 0 || result == AVERROR_EOF)) {
+        qDebug() << "fingerprinted" << ec.fingerprints.size() << "frames";
+        ec.error = fingerprint_index_write(output_filename, ec.fingerprints.data(), ec.fingerprints.size());
+    }
+    if (result < 0 && result != AVERROR_EOF)
+        return result;
+    return ec.error;
+}
+
+static bool parse_channels(const QString &value, float channels[3])
+{
+    float r, g, b;
+
+    if (sscanf(value.toLocal8Bit().constData(), "%f,%f,%f", &r, &g, &b) != 3)
+        return false;
+    channels[0] = r;
+    channels[1] = g;
+    channels[2] = b;
+    return true;
 }
 
 int main(int argc, char **argv)
 {
     QCoreApplication app (argc, argv);
-    if (argc < 3)
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Extract video frames as images. <output> is either a directory, or a file\n"
+                                     "name pattern with the frame number such as images/%08d.png. A .npy file name\n"
+                                     "stores all frames in one (frames, height, width, 3) uint8 RGB array, a .fpidx\n"
+                                     "file name their perceptual hashes for fingerprint_query.");
+    ExtractOptions options;
+
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Input video file.");
+    parser.addPositionalArgument("output", "Output directory or file name pattern.");
+    QCommandLineOption startOption("start", "Start extracting at <seconds>.", "seconds");
+    parser.addOption(startOption);
+    QCommandLineOption keyframesOption("keyframes", "Extract keyframes only, without decoding the other frames.");
+    parser.addOption(keyframesOption);
+    QCommandLineOption intervalOption("interval", "Extract one frame every <seconds>, seeking to each one.", "seconds");
+    parser.addOption(intervalOption);
+    QCommandLineOption formatOption("format", "Image format: ppm, png, jpeg or webp. Guessed from the output pattern by default.", "format");
+    parser.addOption(formatOption);
+    QCommandLineOption qualityOption("quality", "Quality 1-100 for jpeg and webp, compression level 0-9 for png.", "quality");
+    parser.addOption(qualityOption);
+    QCommandLineOption cropOption("crop", "Extract only the <x,y,width,height> region, converting nothing else.", "x,y,w,h");
+    parser.addOption(cropOption);
+    QCommandLineOption previewOption("preview", "Downscale frames to <width> pixels wide, decoding at reduced resolution when the codec supports it.", "width");
+    parser.addOption(previewOption);
+    QCommandLineOption tensorOption("tensor", "Write normalized float32 NCHW tensors of <width>x<height> to the .npy output.", "WxH");
+    parser.addOption(tensorOption);
+    QCommandLineOption meanOption("mean", "Per channel mean for --tensor, 0.485,0.456,0.406 by default.", "r,g,b");
+    parser.addOption(meanOption);
+    QCommandLineOption stdOption("std", "Per channel standard deviation for --tensor, 0.229,0.224,0.225 by default.", "r,g,b");
+    parser.addOption(stdOption);
+    QCommandLineOption batchOption("batch", "Group tensors into batches of <size>, the last one zero padded.", "size");
+    parser.addOption(batchOption);
+    QCommandLineOption threadsOption("threads", "Number of conversion/writer threads, one per core by default.", "count");
+    parser.addOption(threadsOption);
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() < 2)
     {
         av_log(NULL, AV_LOG_ERROR, "Incorrect input\n");
         return 1;
     }
+    if (parser.isSet(startOption))
+        options.start_time = parser.value(startOption).toDouble();
+    options.keyframes_only = parser.isSet(keyframesOption);
+    if (parser.isSet(intervalOption))
+        options.interval = parser.value(intervalOption).toDouble();
+    if (parser.isSet(formatOption)) {
+        options.format = find_image_format(parser.value(formatOption).toLocal8Bit().constData());
+        if (!options.format) {
+            av_log(NULL, AV_LOG_ERROR, "Unknown image format\n");
+            return 1;
+        }
+    }
+    if (parser.isSet(qualityOption))
+        options.quality = parser.value(qualityOption).toInt();
+    if (parser.isSet(cropOption)) {
+        if (crop_parse(&options.crop_rect, parser.value(cropOption).toLocal8Bit().constData()) < 0)
+            return 1;
+        options.crop = true;
+    }
+    if (parser.isSet(previewOption))
+        options.preview_width = parser.value(previewOption).toInt();
+    if (parser.isSet(tensorOption)) {
+        if (sscanf(parser.value(tensorOption).toLocal8Bit().constData(), "%dx%d",
+                   &options.tensor_width, &options.tensor_height) != 2 ||
+            options.tensor_width <= 0 || options.tensor_height <= 0) {
+            av_log(NULL, AV_LOG_ERROR, "Invalid tensor size\n");
+            return 1;
+        }
+    }
+    if ((parser.isSet(meanOption) && !parse_channels(parser.value(meanOption), options.mean)) ||
+        (parser.isSet(stdOption) && !parse_channels(parser.value(stdOption), options.std)) ||
+        !options.std[0] || !options.std[1] || !options.std[2]) {
+        av_log(NULL, AV_LOG_ERROR, "Expected three comma separated values for --mean and non zero ones for --std\n");
+        return 1;
+    }
+    if (parser.isSet(batchOption))
+        options.batch = parser.value(batchOption).toInt();
+    if (parser.isSet(threadsOption))
+        options.threads = parser.value(threadsOption).toInt();
 
-    if (video_decode_example(argv[1], argv[2]) != 0)
+    const QByteArray input_filename = args.at(0).toLocal8Bit();
+    const QByteArray output_filename = args.at(1).toLocal8Bit();
+    if (video_decode_example(input_filename.constData(), output_filename.constData(), options) != 0)
         return 1;
 
     return 0;
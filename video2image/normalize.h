@@ -0,0 +1,23 @@
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#include <stdint.h>
+
+/**
+ * Per-channel normalization of 8 bit samples into float32 tensor planes:
+ * dst = (src / 255 - mean) / std, folded into dst = src * scale + bias.
+ */
+struct ChannelNorm {
+    float scale;
+    float bias;
+};
+
+ChannelNorm channel_norm(float mean, float std);
+
+/**
+ * Normalize a width x height plane of src (rows linesize bytes apart) into
+ * the packed float plane dst. Uses AVX2 when the CPU has it.
+ */
+void normalize_plane(float *dst, const uint8_t *src, int linesize, int width, int height, ChannelNorm norm);
+
+#endif /* NORMALIZE_H */
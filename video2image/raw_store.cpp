@@ -0,0 +1,140 @@
+#include "raw_store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+extern "C"
+{
+    #include <libavutil/error.h>
+    #include <libavutil/log.h>
+}
+
+RawFrameStore::~RawFrameStore()
+{
+    close();
+}
+
+int RawFrameStore::open(const char *filename, const char *descr, const std::vector<int> &frame_shape,
+                        size_t element_size, int64_t expected_frames, int batch)
+{
+    descr_ = descr;
+    frame_shape_ = frame_shape;
+    batch_ = batch;
+    frame_size_ = element_size;
+    for (int dim : frame_shape)
+        frame_size_ *= dim;
+
+    fd_ = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Can't open %s\n", filename);
+        return AVERROR(errno);
+    }
+    return grow(stored_frames(expected_frames > 0 ? expected_frames : 1));
+}
+
+/* Must be called with the lock held exclusively, or before any worker runs. */
+int RawFrameStore::grow(int64_t frames)
+{
+    size_t size = header_size + frames * frame_size_;
+
+    if (data_)
+        munmap(data_, mapped_size_);
+    data_ = NULL;
+    capacity_ = 0;
+    if (ftruncate(fd_, size) < 0)
+        return AVERROR(errno);
+    data_ = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data_ == MAP_FAILED) {
+        data_ = NULL;
+        return AVERROR(errno);
+    }
+    mapped_size_ = size;
+    capacity_ = frames;
+    return 0;
+}
+
+uint8_t *RawFrameStore::begin_frame(int64_t index)
+{
+    while (1) {
+        mutex_.lock_shared();
+        if (data_ && index < capacity_) {
+            int64_t count = count_.load();
+            while (count < index + 1 && !count_.compare_exchange_weak(count, index + 1))
+                ;
+            return data_ + header_size + index * frame_size_;
+        }
+        mutex_.unlock_shared();
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        // another worker may have grown it in the meantime
+        if (index >= capacity_ && grow(stored_frames(std::max(capacity_ * 2, index + 1))) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Can't grow the raw frame store\n");
+            return NULL;
+        }
+    }
+}
+
+void RawFrameStore::end_frame()
+{
+    mutex_.unlock_shared();
+}
+
+/* Frames actually stored, rounded up to whole batches. */
+int64_t RawFrameStore::stored_frames(int64_t frames) const
+{
+    if (batch_ > 1)
+        return (frames + batch_ - 1) / batch_ * batch_;
+    return frames;
+}
+
+void RawFrameStore::write_header(int64_t frames)
+{
+    char *header = (char *)data_;
+    std::string shape;
+    int len;
+
+    if (batch_ > 1)
+        shape = std::to_string(frames / batch_) + ", " + std::to_string(batch_);
+    else
+        shape = std::to_string(frames);
+    for (int dim : frame_shape_)
+        shape += ", " + std::to_string(dim);
+
+    // magic, version 1.0, little endian header length, then a python dict
+    // padded with spaces and ended by a newline
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (header_size - 10) & 0xff;
+    header[9] = (header_size - 10) >> 8;
+    len = snprintf(header + 10, header_size - 10,
+                   "{'descr': '%s', 'fortran_order': False, 'shape': (%s), }", descr_.c_str(), shape.c_str());
+    // a shape too long for the fixed header can't happen with the few
+    // dimensions used here, but never write past it
+    len = std::min(std::max(len, 0), (int)header_size - 11);
+    memset(header + 10 + len, ' ', header_size - 10 - len);
+    header[header_size - 1] = '\n';
+}
+
+int RawFrameStore::close()
+{
+    int64_t frames = stored_frames(count_.load());
+    int ret = 0;
+
+    if (fd_ < 0)
+        return 0;
+    if (data_) {
+        write_header(frames);
+        munmap(data_, mapped_size_);
+        data_ = NULL;
+    }
+    // drop the unused preallocated tail
+    if (ftruncate(fd_, header_size + frames * frame_size_) < 0)
+        ret = AVERROR(errno);
+    ::close(fd_);
+    fd_ = -1;
+    return ret;
+}
@@ -0,0 +1,67 @@
+#ifndef RAW_STORE_H
+#define RAW_STORE_H
+
+#include <atomic>
+#include <shared_mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * All extracted frames in one memory-mapped NumPy .npy file, an array of
+ * shape (frames, <frame shape>) such as (frames, height, width, 3) uint8 RGB,
+ * so consumers can np.load(..., mmap_mode='r') it without parsing anything.
+ * With a batch size the leading dimension is split into (batches, batch) and
+ * the last batch is zero padded.
+ *
+ * The file is preallocated for the expected frame count and workers convert
+ * straight into their slot of the mapping. It grows (ftruncate + remap) when
+ * more frames come than expected; the header has a fixed, padded size so the
+ * final frame count can be written over it by close() without moving data.
+ */
+class RawFrameStore {
+public:
+    static const size_t header_size = 128; ///< keeps frame data 64 byte aligned
+
+    RawFrameStore() = default;
+    ~RawFrameStore();
+
+    RawFrameStore(const RawFrameStore &) = delete;
+    RawFrameStore &operator=(const RawFrameStore &) = delete;
+
+    /**
+     * @param descr        numpy type of the elements, e.g. "|u1" or "<f4"
+     * @param frame_shape  dimensions of one frame
+     */
+    int open(const char *filename, const char *descr, const std::vector<int> &frame_shape,
+             size_t element_size, int64_t expected_frames, int batch = 0);
+
+    /**
+     * Pointer to the data of frame index, valid until the matching
+     * end_frame(). NULL if the file could not grow.
+     */
+    uint8_t *begin_frame(int64_t index);
+    void end_frame();
+
+    /** Write the final header, trim the file and unmap it. */
+    int close();
+
+private:
+    int grow(int64_t frames);
+    void write_header(int64_t frames);
+    int64_t stored_frames(int64_t frames) const;
+
+    std::shared_mutex mutex_; ///< shared while writing a frame, exclusive to remap
+    int fd_ = -1;
+    uint8_t *data_ = NULL;
+    size_t mapped_size_ = 0;
+    std::string descr_;
+    std::vector<int> frame_shape_;
+    int batch_ = 0;
+    size_t frame_size_ = 0;
+    int64_t capacity_ = 0;
+    std::atomic<int64_t> count_{0};
+};
+
+#endif /* RAW_STORE_H */